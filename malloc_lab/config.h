@@ -58,10 +58,15 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes, unless set by mdriver -M at run time
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Size in bytes of the region that models mmap for huge blocks
+ */
+#define MAX_MAP (20*(1<<20))  /* 20 MB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -15,8 +15,12 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "mm.h"
+#include "region.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
@@ -29,9 +33,14 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MT_RUNS        3 /* best of this many runs in eval_mm_threads */
+#define LAT_RUNS       5 /* best of this many runs in eval_mm_latency */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
 
 /****************************** 
  * The key compound data types 
@@ -46,9 +55,12 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, CALLOC, MEMALIGN, USABLE,
+	  REGION_ALLOC, REGION_RESET} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int align;                        /* alignment of a MEMALIGN request */
+    int region;                       /* region of a REGION_xxx request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -60,6 +72,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int num_regions;     /* number of regions that ids are tagged with */
+    int *region_next;    /* id allocated before each id in its region, or -1 */
 } trace_t;
 
 /* 
@@ -70,6 +84,9 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    int *runs;       /* if set, replay runs of requests by batch calls (-B) */
+    void **ptrs;     /* blocks of a run, for the batch calls */
+    region_t **regions; /* if set, serve tagged requests from regions (-R) */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -81,17 +98,63 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double secs1;    /* wall secs to replay the trace on one thread (-T) */
+    double secsn;    /* wall secs to replay it on each of nthreads (-T) */
+    double lat[3];   /* worst-case nsecs of an ALLOC, FREE, REALLOC (-L) */
+    double reallocs; /* number of realloc requests in the trace */
+    double copies;   /* reallocs that moved the payload */
+    double avoided;  /* reallocs that kept the payload where it was */
+    double peak_heap;  /* largest heap size while replaying the trace */
+    double final_heap; /* heap size after the last request of the trace */
+    double resident;   /* largest resident size while replaying the trace */
+    double final_resident; /* resident size after the last request */
+    double sbrks;      /* number of mem_sbrk calls made by the trace */
+    double grow;       /* grow step of the heap after the trace */
+    double batched;    /* requests in runs replayed by a batch call (-B) */
+    double secs_batch; /* secs to replay the trace with batch calls (-B) */
+    double tagged;      /* requests tagged with a region */
+    double secs_region; /* secs to replay the trace with regions (-R) */
+    double peak_region; /* largest heap size when replayed with regions */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Holds the params to a thread replaying a trace in eval_mm_threads */
+typedef struct {
+    trace_t *trace;             /* shared, read-only request array */
+    char **blocks;              /* this thread's ptrs returned by malloc... */
+    pthread_barrier_t *barrier; /* lets all threads start at once */
+    struct timeval start, end;  /* when this thread started/finished */
+    int failed;                 /* set if mm_malloc/mm_realloc failed */
+    mm_heap_t *heap;            /* the mm heap the trace is replayed on */
+} thread_t;
+
+/* Holds the params to a worker replaying traces in eval_mm_traces (-j) */
+typedef struct {
+    char **tracefiles;  /* shared list of traces to replay */
+    int num_tracefiles; /* the number of traces in that list */
+    stats_t *stats;     /* stats of each trace, set by the worker replaying it */
+    int *next;          /* index of the next trace that no worker has taken */
+} worker_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
+static int check_every = 0; /* if set, run mm_check every this many ops (-C) */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* Options of the mm replay, read by each worker of eval_mm_traces */
+static int nthreads = 0;    /* If set, also replay on this many threads (-T) */
+static int latency = 0;     /* If set, measure per-op worst-case latency (-L) */
+static int batch = 0;       /* If set, also replay with batch calls (-B) */
+static int region = 0;      /* If set, also replay with regions (-R) */
+static FILE *access_log = NULL; /* If set, log heap accesses of mm.c to it (-A) */
+static size_t max_heap = MAX_HEAP; /* Most bytes of the heap (-M) */
+static int huge = 0;        /* If set, put the heap on huge pages (-H) */
+static int jobs = 1;        /* Replay this many traces at once (-j) */
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -121,12 +184,32 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 region_t **regions);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_traces(char **tracefiles, int n, stats_t *stats);
+static void *trace_worker(void *ptr);
+static void eval_mm_trace(char *tracefile, int i, stats_t *stats);
+static double eval_mm_threads(trace_t *trace, int nthreads);
+static void *replay_thread(void *ptr);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void count_arenas(trace_t *trace, stats_t *stats);
+static int batch_run(trace_t *trace, int i);
+
+/* These functions serve the ALLOC, CALLOC and MEMALIGN requests */
+static char *mm_alloc_request(traceop_t *op);
+static char *libc_alloc_request(traceop_t *op);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printthreads(int n, stats_t *stats, int nthreads);
+static void printbatch(int n, stats_t *stats);
+static void printregions(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printreallocs(int n, stats_t *stats);
+static void printheap(int n, stats_t *stats, int growth);
+static void printarenas(void);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -142,7 +225,6 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -158,7 +240,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:T:C:A:M:j:hvVgalLBRH")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -181,6 +263,54 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'T': /* Replay each trace on this many threads */
+            if (!MM_THREADS) {
+                printf("ERROR: -T needs mm.c built with MM_THREADS=1\n");
+                exit(1);
+            }
+            if ((nthreads = atoi(optarg)) < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'C': /* Check the heap every n requests */
+            if ((check_every = atoi(optarg)) < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'A': /* Log the heap accesses of mm.c, for cache_lab/csim */
+            if (!MM_ACCESS) {
+                printf("ERROR: -A needs mm.c built with MM_ACCESS=1\n");
+                exit(1);
+            }
+            if ((access_log = fopen(optarg, "w")) == NULL)
+                unix_error("ERROR: can't open the access log");
+            break;
+        case 'M': /* Let the heap grow to this many MB */
+            if ((max_heap = (size_t)atoi(optarg) << 20) == 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'j': /* Replay this many traces at once, each on its own heap */
+            if ((jobs = atoi(optarg)) < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'H': /* Ask for huge pages for the heap */
+            huge = 1;
+            break;
+        case 'L': /* Measure the latency of each request */
+            latency = 1;
+            break;
+        case 'B': /* Replay runs of requests by the batch calls as well */
+            batch = 1;
+            break;
+        case 'R': /* Replay the requests tagged with a region by regions */
+            region = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
@@ -225,6 +355,12 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+    /* The access log holds the requests of one trace at a time */
+    if (access_log != NULL && jobs > 1) {
+	printf("ERROR: -A needs the traces replayed one at a time (-j 1)\n");
+	exit(1);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -235,6 +371,14 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Print the build options of mm.c, to compare runs of several builds */
+    if (verbose)
+	printf("mm.c built with MM_POLICY=%d MM_ORDER=%d MM_PREFETCH=%d "
+	       "MM_DEFER=%d MM_THREADS=%d MM_ARENAS=%d MM_PROFILE=%d "
+	       "MM_LIFETIME=%d\n",
+	       MM_POLICY, MM_ORDER, MM_PREFETCH, MM_DEFER, MM_THREADS,
+	       MM_ARENAS, MM_PROFILE, MM_LIFETIME);
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -284,34 +428,48 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
     
-    /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
-
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    eval_mm_traces(tracefiles, num_tracefiles, mm_stats);
 
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printf("Results for mm_realloc:\n");
+	printreallocs(num_tracefiles, mm_stats);
+	printf("\n");
+	printf("Heap size of mm malloc (bytes):\n");
+	printheap(num_tracefiles, mm_stats, verbose > 1);
+	printf("\n");
+    }
+
+    /* Display the throughput scaling of the mm package */
+    if (nthreads) {
+	printf("\nResults for mm malloc on %d threads:\n", nthreads);
+	printthreads(num_tracefiles, mm_stats, nthreads);
+	printf("\n");
+    }
+
+    /* Display the speedup of replaying runs of requests by batch calls */
+    if (batch) {
+	printf("\nResults for mm malloc with batch calls:\n");
+	printbatch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the gain of freeing tagged requests by resetting regions */
+    if (region) {
+	printf("\nResults for mm malloc with regions:\n");
+	printregions(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the worst-case latency of each kind of request */
+    if (latency) {
+	printf("\nWorst-case latency of mm malloc (nsecs):\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
     }
 
     /* 
@@ -395,8 +553,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+    /* The payload must lie within the extent of the heap or a mapping */
+    if (mem_is_mapped(lo) && mem_is_mapped(hi))
+	;
+    else if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
 	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -477,9 +637,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    char msg[MAXLINE];
+    unsigned index, size, align, region;
     unsigned max_index = 0;
     unsigned op_index;
+    int i, *last;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -514,6 +676,12 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    /* ... and chain the ids tagged with each region */
+    if ((trace->region_next = 
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
+    trace->num_regions = 0;
     
     /* read every request line in the trace file */
     index = 0;
@@ -539,6 +707,41 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &align, &size);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].align = align;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'u':
+	    fscanf(tracefile, "%u", &index);
+	    trace->ops[op_index].type = USABLE;
+	    trace->ops[op_index].index = index;
+	    break;
+	case 'g':
+	    fscanf(tracefile, "%u %u %u", &index, &region, &size);
+	    trace->ops[op_index].type = REGION_ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].region = region;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    trace->num_regions = MAX(trace->num_regions, (int)region + 1);
+	    break;
+	case 'x':
+	    fscanf(tracefile, "%u", &region);
+	    trace->ops[op_index].type = REGION_RESET;
+	    trace->ops[op_index].region = region;
+	    trace->num_regions = MAX(trace->num_regions, (int)region + 1);
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -550,19 +753,41 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+
+    /* 
+     * Link each tagged id to the one tagged before it with the same 
+     * region, and a reset to the last id it frees, or -1 if none
+     */
+    if ((last = (int *)malloc((trace->num_regions + 1) * sizeof(int))) == NULL)
+	unix_error("malloc 6 failed in read_trace");
+    for (i = 0; i < trace->num_regions; i++)
+	last[i] = -1;
+    for (i = 0; i < trace->num_ops; i++) {
+	region = trace->ops[i].region;
+	if (trace->ops[i].type == REGION_ALLOC) {
+	    trace->region_next[trace->ops[i].index] = last[region];
+	    last[region] = trace->ops[i].index;
+	}
+	else if (trace->ops[i].type == REGION_RESET) {
+	    trace->ops[i].index = last[region];
+	    last[region] = -1;
+	}
+    }
+    free(last);
     
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
+ * free_trace - Free the trace record and the four arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    free(trace->ops);         /* free the four arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->region_next);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -572,9 +797,11 @@ void free_trace(trace_t *trace)
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * eval_mm_valid - Check the mm malloc package for correctness. If
+ *    regions is set, requests tagged with a region are served by it.
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 region_t **regions) 
 {
     int i, j;
     int index;
@@ -593,6 +820,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    for (i = 0; regions != NULL && i < trace->num_regions; i++) {
+	if ((regions[i] = mm_region_create()) == NULL) {
+	    malloc_error(tracenum, 0, "mm_region_create failed.");
+	    return 0;
+	}
+    }
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -602,9 +835,16 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_aligned_alloc */
+        case REGION_ALLOC: /* mm_region_alloc, or mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if (trace->ops[i].type == REGION_ALLOC && regions != NULL)
+		p = mm_region_alloc(regions[trace->ops[i].region], size);
+	    else
+		p = mm_alloc_request(&trace->ops[i]);
+	    if (p == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -616,6 +856,23 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
+
+	    /* A calloc block must be zeroed, an aligned one aligned */
+	    if (trace->ops[i].type == CALLOC) {
+		for (j = 0; j < size; j++) {
+		    if (p[j] != 0) {
+			malloc_error(tracenum, i, "mm_calloc did not zero "
+				     "the block");
+			return 0;
+		    }
+		}
+	    }
+	    if (trace->ops[i].type == MEMALIGN && 
+		(size_t)p % trace->ops[i].align != 0) {
+		malloc_error(tracenum, i, "mm_aligned_alloc did not align "
+			     "the block");
+		return 0;
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -653,7 +910,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -674,11 +931,58 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+        case REGION_RESET: /* mm_region_reset, or mm_free of each id */
+
+	    /* The blocks of the region must have kept their data */
+	    for (index = trace->ops[i].index; index >= 0; 
+		 index = trace->region_next[index]) {
+		p = trace->blocks[index];
+		for (j = 0; j < trace->block_sizes[index]; j++) {
+		    if ((unsigned char)p[j] != (index & 0xFF)) {
+			malloc_error(tracenum, i, "block of a region was "
+				     "overwritten");
+			return 0;
+		    }
+		}
+		remove_range(ranges, p);
+		if (regions == NULL)
+		    mm_free(p);
+	    }
+	    if (regions != NULL)
+		mm_region_reset(regions[trace->ops[i].region]);
+	    break;
+
+        case USABLE: /* mm_usable_size */
+
+	    /* The whole usable size must be ours to write */
+	    p = trace->blocks[index];
+	    size = mm_usable_size(p);
+	    if ((size_t)size < trace->block_sizes[index]) {
+		malloc_error(tracenum, i, "mm_usable_size is less than the "
+			     "size asked for");
+		return 0;
+	    }
+	    remove_range(ranges, p);
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->block_sizes[index] = size;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Check the blocks changed since the last check, and all at the end */
+	if (check_every && 
+	    ((i + 1) % check_every == 0 || i + 1 == trace->num_ops) &&
+	    mm_check(i + 1 < trace->num_ops) < 0) {
+	    malloc_error(tracenum, i, "mm_check found the heap broken.");
+	    return 0;
+	}
     }
+    for (i = 0; regions != NULL && i < trace->num_regions; i++)
+	mm_region_destroy(regions[i]);
 
     /* As far as we know, this is a valid malloc package */
     return 1;
@@ -714,11 +1018,17 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_aligned_alloc */
+        case REGION_ALLOC: /* mm_malloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = mm_alloc_request(&trace->ops[i])) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
+
+	    /* Write the payload like a program would, so that it is resident */
+	    memset(p, index & 0xFF, size);
 	    
 	    /* Remember region and size */
 	    trace->blocks[index] = p;
@@ -741,6 +1051,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldp = trace->blocks[index];
 	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
+	    memset(newp, index & 0xFF, newsize);
 
 	    /* Remember region and size */
 	    trace->blocks[index] = newp;
@@ -768,13 +1079,26 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case REGION_RESET: /* mm_free of each id of the region */
+	    for (index = trace->ops[i].index; index >= 0; 
+		 index = trace->region_next[index]) {
+		mm_free(trace->blocks[index]);
+		total_size -= trace->block_sizes[index];
+	    }
+	    break;
+
+        case USABLE: /* mm_usable_size, payload is still what was asked */
+	    mm_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* The heap may have shrunk since its peak, which is what counts */
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -784,25 +1108,67 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, j, n, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    int *runs = ((speed_t *)ptr)->runs;
+    void **ptrs = ((speed_t *)ptr)->ptrs;
+    region_t **regions = ((speed_t *)ptr)->regions;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    for (i = 0; regions != NULL && i < trace->num_regions; i++)
+	if ((regions[i] = mm_region_create()) == NULL)
+	    app_error("mm_region_create error in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i++) {
+
+	/* In batched mode, a run of requests is made by one batch call */
+	if (runs != NULL && (n = runs[i]) > 1) {
+	    if (trace->ops[i].type == FREE) {
+		for (j = 0; j < n; j++)
+		    ptrs[j] = trace->blocks[trace->ops[i + j].index];
+		mm_free_batch(ptrs, n);
+	    }
+	    else {
+		if (mm_malloc_batch(trace->ops[i].size, n, ptrs) < n)
+		    app_error("mm_malloc_batch error in eval_mm_speed");
+		for (j = 0; j < n; j++) {
+		    index = trace->ops[i + j].index;
+		    trace->blocks[index] = ptrs[j];
+		    trace->block_sizes[index] = trace->ops[i].size;
+		}
+	    }
+	    i += n - 1;
+	    continue;
+	}
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_aligned_alloc */
+            index = trace->ops[i].index;
+            if ((p = mm_alloc_request(&trace->ops[i])) == NULL)
+		app_error("mm_malloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = trace->ops[i].size;
+            break;
+
+        case REGION_ALLOC: /* mm_region_alloc, or mm_malloc */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if (regions != NULL)
+		p = mm_region_alloc(regions[trace->ops[i].region], 
+				    trace->ops[i].size);
+            else
+		p = mm_malloc(trace->ops[i].size);
+            if (p == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = trace->ops[i].size;
             break;
 
 	case REALLOC: /* mm_realloc */
@@ -812,17 +1178,460 @@ static void eval_mm_speed(void *ptr)
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
-        case FREE: /* mm_free */
+        case FREE: /* mm_free, given the size in batched mode */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            if (runs != NULL)
+		mm_free_sized(block, trace->block_sizes[index]);
+            else
+		mm_free(block);
+            break;
+
+        case USABLE: /* mm_usable_size */
+            mm_usable_size(trace->blocks[trace->ops[i].index]);
+            break;
+
+        case REGION_RESET: /* mm_region_reset, or mm_free of each id */
+            if (regions != NULL) {
+		mm_region_reset(regions[trace->ops[i].region]);
+		break;
+            }
+            for (index = trace->ops[i].index; index >= 0; 
+		 index = trace->region_next[index])
+		mm_free(trace->blocks[index]);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+    }
+    for (i = 0; regions != NULL && i < trace->num_regions; i++)
+	mm_region_destroy(regions[i]);
+}
+
+/*
+ * batch_run - Returns the length of the run of frees, or of mallocs of
+ *    one size, starting at request i, which a batch call can make at once
+ */
+static int batch_run(trace_t *trace, int i)
+{
+    traceop_t *op = &trace->ops[i];
+    int n = 1;
+
+    if (op->type != FREE && op->type != ALLOC)
+	return 1;
+    while (i + n < trace->num_ops && op[n].type == op->type &&
+	   (op->type == FREE || op[n].size == op->size))
+	n++;
+    return n;
+}
+
+/*
+ * eval_mm_traces - Evaluate the mm package on each of the n traces.
+ *    With -j, that many workers replay the traces at once, each on an
+ *    mm heap and memlib heap of its own, so that traces don't share
+ *    any state of the allocator.
+ */
+static void eval_mm_traces(char **tracefiles, int n, stats_t *stats)
+{
+    int i, next = 0;
+    int nworkers = MIN(jobs, n);
+    pthread_t *tids;
+    worker_t params;
+
+    if (nworkers <= 1) {
+	/* Initialize the simulated memory system in memlib.c */
+	mem_init_heap(max_heap, huge);
+	for (i = 0; i < n; i++)
+	    eval_mm_trace(tracefiles[i], i, &stats[i]);
+	return;
+    }
+
+    params.tracefiles = tracefiles;
+    params.num_tracefiles = n;
+    params.stats = stats;
+    params.next = &next;
+    if ((tids = (pthread_t *)malloc(nworkers * sizeof(pthread_t))) == NULL)
+	unix_error("malloc failed in eval_mm_traces");
+    for (i = 0; i < nworkers; i++)
+	if (pthread_create(&tids[i], NULL, trace_worker, &params) != 0)
+	    unix_error("pthread_create failed in eval_mm_traces");
+    for (i = 0; i < nworkers; i++)
+	pthread_join(tids[i], NULL);
+    free(tids);
+}
+
+/*
+ * trace_worker - Thread routine of eval_mm_traces. Takes the next trace
+ *    no other worker has taken until none is left, and evaluates it on
+ *    this worker's own heap.
+ */
+static void *trace_worker(void *ptr)
+{
+    int i;
+    worker_t *params = (worker_t *)ptr;
+    mem_heap_t *mem;
+    mm_heap_t *heap;
+
+    if ((mem = mem_heap_create(max_heap, huge)) == NULL ||
+	(heap = mm_heap_create()) == NULL)
+	unix_error("ERROR: can't create a heap in trace_worker");
+    mem_use(mem);
+    mm_use(heap);
+
+    while ((i = __atomic_fetch_add(params->next, 1, __ATOMIC_RELAXED)) <
+	   params->num_tracefiles)
+	eval_mm_trace(params->tracefiles[i], i, &params->stats[i]);
+
+    mm_heap_destroy(heap);
+    mem_use(NULL);
+    mem_heap_destroy(mem);
+    return NULL;
+}
+
+/*
+ * eval_mm_trace - Evaluate the correctness, space utilization and speed
+ *    of the mm package on trace i, on the heap of the calling thread
+ */
+static void eval_mm_trace(char *tracefile, int i, stats_t *stats)
+{
+    int j;
+    trace_t *trace;
+    range_t *ranges = NULL;   /* keeps track of block extents for the trace */
+    speed_t speed_params;     /* input parameters to eval_mm_speed */
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, i, &ranges, NULL);
+    if (stats->valid) {
+	count_arenas(trace, stats);
+	if (verbose > 1)
+	    printf("efficiency, ");
+	mem_track_resident(1);
+#if MM_ACCESS
+	/* Like the profile, the log holds the run of eval_mm_util */
+	mm_access_log(access_log);
+	stats->util = eval_mm_util(trace, i, &ranges);
+	mm_access_log(NULL);
+#else
+	stats->util = eval_mm_util(trace, i, &ranges);
+#endif
+	stats->peak_heap = mem_peak_heapsize();
+	stats->final_heap = mem_heapsize();
+	stats->resident = mem_peak_resident();
+	stats->final_resident = mem_resident_bytes();
+	mem_track_resident(0);
+#if MM_PROFILE
+	/* The profile counts the requests of the run of eval_mm_util */
+	flockfile(stdout);
+	printf("\nProfile of mm malloc on %s:\n", tracefile);
+	mm_profile_dump(stdout);
+	funlockfile(stdout);
+#endif
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	speed_params.runs = NULL;
+	speed_params.regions = NULL;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+	if (batch) {
+	    if ((speed_params.runs = 
+		 malloc(trace->num_ops * sizeof(int))) == NULL ||
+		(speed_params.ptrs = 
+		 malloc(trace->num_ops * sizeof(void *))) == NULL)
+		unix_error("malloc failed in eval_mm_trace");
+	    for (j = 0; j < trace->num_ops; j++) {
+		speed_params.runs[j] = batch_run(trace, j);
+		if (speed_params.runs[j] > 1 && 
+		    (j == 0 || speed_params.runs[j - 1] == 1))
+		    stats->batched += speed_params.runs[j];
+	    }
+	    stats->secs_batch = fsecs(eval_mm_speed, &speed_params);
+	    free(speed_params.runs);
+	    free(speed_params.ptrs);
+	    speed_params.runs = NULL;
+	}
+	for (j = 0; j < trace->num_ops; j++)
+	    if (trace->ops[j].type == REGION_ALLOC)
+		stats->tagged++;
+	if (region && trace->num_regions > 0) {
+	    if ((speed_params.regions = 
+		 malloc(trace->num_regions * sizeof(region_t *))) == NULL)
+		unix_error("malloc failed in eval_mm_trace");
+	    if (eval_mm_valid(trace, i, &ranges, speed_params.regions)) {
+		stats->peak_region = mem_peak_heapsize();
+		stats->secs_region = fsecs(eval_mm_speed, &speed_params);
+	    }
+	    free(speed_params.regions);
+	    speed_params.regions = NULL;
+	}
+	if (nthreads) {
+	    stats->secs1 = eval_mm_threads(trace, 1);
+	    stats->secsn = eval_mm_threads(trace, nthreads);
+	}
+	if (latency)
+	    eval_mm_latency(trace, stats);
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_threads - Replay a trace concurrently on nthreads threads
+ *    sharing one mm heap, each thread with its own set of blocks.
+ *    As each thread holds the blocks of the whole trace, the heap may
+ *    grow to nthreads times the limit of -M. Returns the best
+ *    wall-clock secs of MT_RUNS runs, or -1 if the heap ran out of
+ *    memory.
+ */
+static double eval_mm_threads(trace_t *trace, int nthreads)
+{
+    int i, run;
+    double secs, best = -1;
+    struct timeval *start, *end;
+    pthread_t *tids;
+    thread_t *params;
+    pthread_barrier_t barrier;
+    mem_heap_t *mem, *old_mem = mem_current();
+    mm_heap_t *heap, *old_heap = mm_current();
+
+    /* Offsets of mm.c are 32 bits, which bounds the heap to 4 GB */
+    if ((mem = mem_heap_create(MIN(max_heap * nthreads, (size_t)4095 << 20),
+			       huge)) == NULL ||
+	(heap = mm_heap_create()) == NULL)
+	unix_error("ERROR: can't create a heap in eval_mm_threads");
+    mem_use(mem);
+    mm_use(heap);
+
+    if ((tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL ||
+	(params = (thread_t *)calloc(nthreads, sizeof(thread_t))) == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+    for (i = 0; i < nthreads; i++) {
+	params[i].trace = trace;
+	params[i].barrier = &barrier;
+	params[i].heap = heap;
+	if ((params[i].blocks = 
+	     (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    unix_error("malloc failed in eval_mm_threads");
+    }
+
+    for (run = 0; run < MT_RUNS; run++) {
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_threads");
+
+	pthread_barrier_init(&barrier, NULL, nthreads);
+	for (i = 0; i < nthreads; i++) {
+	    params[i].failed = 0;
+	    if (pthread_create(&tids[i], NULL, replay_thread, &params[i]) != 0)
+		unix_error("pthread_create failed in eval_mm_threads");
+	}
+	for (i = 0; i < nthreads; i++)
+	    pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&barrier);
+
+	/* Time from the first thread starting to the last one finishing */
+	start = &params[0].start;
+	end = &params[0].end;
+	for (i = 0; i < nthreads; i++) {
+	    if (params[i].failed) {
+		best = -1;
+		goto done;
+	    }
+	    if (timercmp(&params[i].start, start, <))
+		start = &params[i].start;
+	    if (timercmp(&params[i].end, end, >))
+		end = &params[i].end;
+	}
+	secs = (end->tv_sec - start->tv_sec) + 
+	    (end->tv_usec - start->tv_usec) / 1e6;
+	if (best < 0 || secs < best)
+	    best = secs;
+    }
+
+ done:
+    if (verbose > 1 && nthreads > 1)
+	printarenas();
+    mm_use(old_heap);
+    mem_use(old_mem);
+    mm_heap_destroy(heap);
+    mem_heap_destroy(mem);
+    for (i = 0; i < nthreads; i++)
+	free(params[i].blocks);
+    free(params);
+    free(tids);
+    return best;
+}
+
+/*
+ * replay_thread - Thread routine of eval_mm_threads. Interprets each 
+ *    trace request against the shared mm heap.
+ */
+static void *replay_thread(void *ptr)
+{
+    int i, index;
+    thread_t *params = (thread_t *)ptr;
+    trace_t *trace = params->trace;
+    char **blocks = params->blocks;
+
+    mm_use(params->heap);
+    pthread_barrier_wait(params->barrier);
+    gettimeofday(&params->start, NULL);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_aligned_alloc */
+        case REGION_ALLOC: /* mm_malloc */
+	    if ((blocks[index] = mm_alloc_request(&trace->ops[i])) == NULL) {
+		params->failed = 1;
+		return NULL;
+	    }
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((blocks[index] = 
+		 mm_realloc(blocks[index], trace->ops[i].size)) == NULL) {
+		params->failed = 1;
+		return NULL;
+	    }
+	    break;
+
+        case FREE: /* mm_free */
+	    mm_free(blocks[index]);
+	    break;
+
+        case USABLE: /* mm_usable_size */
+	    mm_usable_size(blocks[index]);
+	    break;
+
+        case REGION_RESET: /* mm_free of each id of the region */
+	    for (; index >= 0; index = trace->region_next[index])
+		mm_free(blocks[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+        }
+    }
+    gettimeofday(&params->end, NULL);
+    return NULL;
+}
+
+/*
+ * eval_mm_latency - Times every request of the trace on its own. Each
+ *    request keeps its best time over LAT_RUNS replays, so that a one-off
+ *    interrupt is not taken for the allocator's worst case, and the
+ *    slowest request of each type is recorded in stats->lat.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    int i, run, index, type;
+    char *p;
+    double *nsecs;
+    struct timespec start, end;
+
+    if ((nsecs = (double *)malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc in eval_mm_latency failed");
+    for (i = 0; i < trace->num_ops; i++)
+	nsecs[i] = DBL_MAX;
+
+    for (run = 0; run < LAT_RUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_latency");
+
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    switch (trace->ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+	    case CALLOC: /* mm_calloc */
+	    case MEMALIGN: /* mm_aligned_alloc */
+	    case REGION_ALLOC: /* mm_malloc */
+		p = mm_alloc_request(&trace->ops[i]);
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+		break;
+
+	    case FREE: /* mm_free */
+		mm_free(trace->blocks[index]);
+		p = NULL;
+		break;
+
+	    case USABLE: /* mm_usable_size */
+		mm_usable_size(trace->blocks[index]);
+		p = NULL;
+		break;
+
+	    case REGION_RESET: /* mm_free of each id of the region */
+		for (; index >= 0; index = trace->region_next[index])
+		    mm_free(trace->blocks[index]);
+		p = NULL;
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_latency");
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+
+	    type = trace->ops[i].type;
+	    if (type != FREE && type != USABLE && type != REGION_RESET) {
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+	    }
+	    nsecs[i] = MIN(nsecs[i], (end.tv_sec - start.tv_sec) * 1e9 +
+			   (end.tv_nsec - start.tv_nsec));
+	}
+    }
+
+    /* calloc, aligned_alloc and tagged requests count as malloc */
+    stats->lat[ALLOC] = stats->lat[FREE] = stats->lat[REALLOC] = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	type = trace->ops[i].type;
+	if (type == USABLE || type == REGION_RESET)
+	    continue;
+	if (type != FREE && type != REALLOC)
+	    type = ALLOC;
+	stats->lat[type] = MAX(stats->lat[type], nsecs[i]);
+    }
+    free(nsecs);
+}
+
+/*
+ * count_arenas - Reads how the reallocs of the trace were served, and
+ *    how the heap grew, in the run of eval_mm_valid.
+ */
+static void count_arenas(trace_t *trace, stats_t *stats)
+{
+    int i;
+    mm_arena_stats_t st;
+
+    stats->reallocs = stats->copies = stats->avoided = 0;
+    stats->sbrks = stats->grow = 0;
+    for (i = 0; i < trace->num_ops; i++)
+	if (trace->ops[i].type == REALLOC)
+	    stats->reallocs++;
+    for (i = 0; i < MM_ARENAS; i++) {
+	mm_arena_stats(i, &st);
+	stats->copies += st.realloc_copies;
+	stats->avoided += st.realloc_in_place + st.realloc_headroom;
+	stats->sbrks += st.sbrk_calls;
+	stats->grow = MAX(stats->grow, st.grow);
+    }
 }
 
 /*
@@ -833,14 +1642,17 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+        case CALLOC: /* calloc */
+        case MEMALIGN: /* aligned_alloc */
+        case REGION_ALLOC: /* malloc */
+	    if ((p = libc_alloc_request(&trace->ops[i])) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
@@ -861,6 +1673,16 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case USABLE: /* malloc_usable_size */
+	    malloc_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
+
+        case REGION_RESET: /* free of each id of the region */
+	    for (index = trace->ops[i].index; index >= 0; 
+		 index = trace->region_next[index])
+		free(trace->blocks[index]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -877,16 +1699,18 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 static void eval_libc_speed(void *ptr)
 {
     int i;
-    int index, size, newsize;
+    int index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
+        case CALLOC: /* calloc */
+        case MEMALIGN: /* aligned_alloc */
+        case REGION_ALLOC: /* malloc */
 	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
+	    if ((p = libc_alloc_request(&trace->ops[i])) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
@@ -906,10 +1730,52 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case USABLE: /* malloc_usable_size */
+	    malloc_usable_size(trace->blocks[trace->ops[i].index]);
+	    break;
+
+        case REGION_RESET: /* free of each id of the region */
+	    for (index = trace->ops[i].index; index >= 0; 
+		 index = trace->region_next[index])
+		free(trace->blocks[index]);
+	    break;
 	}
     }
 }
 
+/*
+ * mm_alloc_request - Serves an ALLOC, CALLOC, MEMALIGN or REGION_ALLOC
+ *    request with the matching function of the mm package
+ */
+static char *mm_alloc_request(traceop_t *op)
+{
+    switch (op->type) {
+    case CALLOC:
+	return mm_calloc(1, op->size);
+    case MEMALIGN:
+	return mm_aligned_alloc(op->align, op->size);
+    default:
+	return mm_malloc(op->size);
+    }
+}
+
+/*
+ * libc_alloc_request - Serves an ALLOC, CALLOC, MEMALIGN or REGION_ALLOC
+ *    request with the matching function of libc
+ */
+static char *libc_alloc_request(traceop_t *op)
+{
+    switch (op->type) {
+    case CALLOC:
+	return calloc(1, op->size);
+    case MEMALIGN:
+	return aligned_alloc(op->align, op->size);
+    default:
+	return malloc(op->size);
+    }
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -972,6 +1838,170 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printbatch - prints the throughput of the mm package replaying the
+ *    trace request by request and with batch calls
+ */
+static void printbatch(int n, stats_t *stats)
+{
+    int i;
+    double kops, kopsb;
+
+    printf("%5s%10s%10s%10s%9s\n", "trace", "batched", "Kops", "Kops(B)",
+	   "speedup");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    kops = (stats[i].ops/1e3)/stats[i].secs;
+	    kopsb = (stats[i].ops/1e3)/stats[i].secs_batch;
+	    printf("%2d%13.0f%10.0f%10.0f%8.2fx\n", i, stats[i].batched,
+		   kops, kopsb, kopsb/kops);
+	}
+	else {
+	    printf("%2d%13s%10s%10s%9s\n", i, "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printregions - prints the throughput and peak heap of the mm package
+ *    when the tagged requests are freed one by one, and when they are
+ *    served by regions and freed by resetting them
+ */
+static void printregions(int n, stats_t *stats)
+{
+    int i;
+    double kops, kopsr;
+
+    printf("%5s%10s%10s%10s%9s%10s%10s\n", "trace", "tagged", "Kops", 
+	   "Kops(R)", "speedup", "peak", "peak(R)");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].secs_region > 0) {
+	    kops = (stats[i].ops/1e3)/stats[i].secs;
+	    kopsr = (stats[i].ops/1e3)/stats[i].secs_region;
+	    printf("%2d%13.0f%10.0f%10.0f%8.2fx%10.0f%10.0f\n", i, 
+		   stats[i].tagged, kops, kopsr, kopsr/kops, 
+		   stats[i].peak_heap, stats[i].peak_region);
+	}
+	else {
+	    printf("%2d%13s%10s%10s%9s%10s%10s\n", i, "-", "-", "-", "-", 
+		   "-", "-");
+	}
+    }
+}
+
+/*
+ * printthreads - prints the throughput of the mm package on one thread
+ *    and on nthreads threads, as measured by eval_mm_threads
+ */
+static void printthreads(int n, stats_t *stats, int nthreads)
+{
+    int i, failed = 0;
+    double kops1, kopsn;
+
+    printf("%5s%10s%10s%9s\n", "trace", "Kops(1)", "Kops(T)", "speedup");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].secs1 > 0 && stats[i].secsn > 0) {
+	    kops1 = (stats[i].ops/1e3)/stats[i].secs1;
+	    kopsn = (nthreads*stats[i].ops/1e3)/stats[i].secsn;
+	    printf("%2d%13.0f%10.0f%8.2fx\n", i, kops1, kopsn, kopsn/kops1);
+	}
+	else {
+	    printf("%2d%13s%10s%9s\n", i, "-", "-", "-");
+	    failed += stats[i].valid;
+	}
+    }
+    if (failed)
+	printf("%d traces ran out of heap on %d threads, "
+	       "raise its limit by -M\n", failed, nthreads);
+}
+
+/*
+ * printreallocs - prints how many reallocs had to copy the payload
+ */
+static void printreallocs(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s\n", "trace", "reallocs", "copies", "avoided");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%13.0f%10.0f%10.0f\n", i, stats[i].reallocs,
+		   stats[i].copies, stats[i].avoided);
+	}
+	else {
+	    printf("%2d%13s%10s%10s\n", i, "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printheap - prints the peak and final heap size of each trace, its 
+ *    peak and final resident size and the utilization of the peak, and
+ *    with growth, the sbrk calls and the grow step it ended with
+ */
+static void printheap(int n, stats_t *stats, int growth)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s%10s%10s%10s", "trace", "peak", "final", 
+	   "returned", "peak rss", "rss util", "final rss");
+    if (growth)
+	printf("%10s%10s", "sbrks", "step");
+    printf("\n");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    /* util is the peak payload over peak_heap, so scale it */
+	    printf("%2d%13.0f%10.0f%9.0f%%%10.0f%9.0f%%%10.0f", i, 
+		   stats[i].peak_heap, stats[i].final_heap,
+		   100 * (1 - stats[i].final_heap / stats[i].peak_heap),
+		   stats[i].resident,
+		   100 * stats[i].util * stats[i].peak_heap / stats[i].resident,
+		   stats[i].final_resident);
+	    if (growth)
+		printf("%10.0f%10.0f", stats[i].sbrks, stats[i].grow);
+	}
+	else {
+	    printf("%2d%13s%10s%10s%10s%10s%10s", i, "-", "-", "-", "-", "-", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printlatency - prints the worst-case latency of each type of request
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s\n", "trace", "malloc", "free", "realloc");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%13.0f%10.0f%10.0f\n", i, stats[i].lat[ALLOC],
+		   stats[i].lat[FREE], stats[i].lat[REALLOC]);
+	}
+	else {
+	    printf("%2d%13s%10s%10s\n", i, "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printarenas - prints the statistics of each arena of the mm package
+ */
+static void printarenas(void)
+{
+    int i;
+    mm_arena_stats_t st;
+
+    printf("%5s%10s%10s%10s\n", "arena", "heap", "free", "remote");
+    for (i = 0; i < MM_ARENAS; i++) {
+	mm_arena_stats(i, &st);
+	printf("%2d%13lu%10lu%10lu\n", i, (unsigned long)st.heap_size,
+	       (unsigned long)st.free_bytes, (unsigned long)st.remote_frees);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -995,7 +2025,7 @@ void unix_error(char *msg)
  */
 void malloc_error(int tracenum, int opnum, char *msg)
 {
-    errors++;
+    __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
@@ -1004,14 +2034,24 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValLBR] [-f <file>] [-t <dir>] [-T <n>]\n");
+    fprintf(stderr, "               [-C <n>] [-A <file>] [-M <MB>] [-H] [-j <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <file>  Log the heap accesses of mm.c to <file>.\n");
+    fprintf(stderr, "\t-B         Also replay runs of requests by batch calls.\n");
+    fprintf(stderr, "\t-C <n>     Check the heap with mm_check every <n> requests.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Ask for huge pages for the heap.\n");
+    fprintf(stderr, "\t-j <n>     Replay <n> traces at once, each on its own heap.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print worst-case latency of each request type.\n");
+    fprintf(stderr, "\t-M <MB>    Let the heap grow to <MB> MB (default MAX_HEAP).\n");
+    fprintf(stderr, "\t-R         Also replay tagged requests by regions.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace on <n> threads.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -14,24 +14,111 @@
 #include "memlib.h"
 #include "config.h"
 
+/* Huge pages are this big, and the heap starts on one */
+#define HUGE_PAGE (2*(1<<20))
+
+/* 
+ * A modeled memory system, of which there may be several. Each thread
+ * works on the one it chose by mem_use, or on a default one.
+ */
+struct mem_heap {
+    size_t max_heap_size; /* bytes reserved for the heap */
+    char *start_brk;      /* points to first byte of heap */
+    char *brk;            /* points to last byte of heap */
+    char *max_addr;       /* largest legal heap address */ 
+    size_t peak;          /* largest heap plus mapped size since reset */
+    char *fresh;          /* heap bytes from here up were never used */
+
+    /* the region that models mmap */
+    char *map_start;      /* points to first byte of the region */
+    int *map_pages;       /* pages of the mapping starting at each page */
+    size_t mapped;        /* number of bytes mapped */
+
+    /* 
+     * residency tracking. Pages are reserved by mem_init, handed out by 
+     * mem_sbrk and mem_map, and only resident once written.
+     */
+    int tracking;         /* set by mem_track_resident */
+    size_t peak_res;      /* most resident bytes since the last reset */
+    unsigned char *res_vec; /* one byte per page for mincore */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_heap_t mem_default;    /* memory of threads that never chose one */
+static __thread mem_heap_t *mem = &mem_default; /* memory of this thread */
+
+static void mem_release(char *lo, char *hi);
+static size_t mem_resident(char *lo, size_t size);
+static void mem_sample_resident(void);
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model with a heap of 
+ *    MAX_HEAP bytes at most
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_init_heap(MAX_HEAP, 0);
+}
+
+/*
+ * mem_init_heap - initialize the memory system model with a heap of
+ *    max_heap bytes at most, rounded up to whole huge pages. If huge is
+ *    set, the system is asked to back the heap and the mappings by huge
+ *    pages, which saves TLB misses on large heaps.
+ */
+void mem_init_heap(size_t max_heap, int huge)
+{
+    char *start;
+
+    /* 
+     * allocate the storage we will use to model the available VM, 
+     * reading as zero until it is first written. It is reserved one huge
+     * page larger, so that the heap can start on a huge page.
+     */
+    mem->max_heap_size = (max_heap + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    start = (char *)mmap(NULL, mem->max_heap_size + HUGE_PAGE, 
+			 PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+    mem->start_brk = (char *)(((size_t)start + HUGE_PAGE - 1) & 
+			     ~(size_t)(HUGE_PAGE - 1));
+    if (mem->start_brk > start)
+	munmap(start, mem->start_brk - start);
+    munmap(mem->start_brk + mem->max_heap_size, 
+	   start + HUGE_PAGE - mem->start_brk);
+    if (huge)
+	madvise(mem->start_brk, mem->max_heap_size, MADV_HUGEPAGE);
+
+    mem->max_addr = mem->start_brk + mem->max_heap_size; /* max legal heap address */
+    mem->brk = mem->start_brk;                  /* heap is empty initially */
+    mem->peak = 0;
+    mem->fresh = mem->start_brk;
+
+    /* reserve the region where mem_map places its mappings */
+    mem->map_start = (char *)mmap(NULL, MAX_MAP, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				 -1, 0);
+    mem->map_pages = (int *)calloc(MAX_MAP / mem_pagesize(), sizeof(int));
+    if (mem->map_start == MAP_FAILED || mem->map_pages == NULL) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+    if (huge)
+	madvise(mem->map_start, MAX_MAP, MADV_HUGEPAGE);
+    mem->mapped = 0;
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem->res_vec = (unsigned char *)malloc((mem->max_heap_size > MAX_MAP ? 
+					   mem->max_heap_size : MAX_MAP) / 
+					  mem_pagesize());
+    if (mem->res_vec == NULL) {
+	fprintf(stderr, "mem_init_vm: malloc error\n");
+	exit(1);
+    }
+    mem->tracking = 0;
+    mem->peak_res = 0;
 }
 
 /* 
@@ -39,7 +126,57 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem->start_brk, mem->max_heap_size);
+    munmap(mem->map_start, MAX_MAP);
+    free(mem->map_pages);
+    free(mem->res_vec);
+}
+
+/*
+ * mem_heap_create - create a memory system model besides the default 
+ *    one, as mem_init_heap would, for threads that choose it by mem_use
+ */
+mem_heap_t *mem_heap_create(size_t max_heap, int huge)
+{
+    mem_heap_t *heap, *cur = mem;
+
+    if ((heap = (mem_heap_t *)calloc(1, sizeof(mem_heap_t))) == NULL)
+	return NULL;
+    mem = heap;
+    mem_init_heap(max_heap, huge);
+    mem = cur;
+    return heap;
+}
+
+/*
+ * mem_heap_destroy - free a model of mem_heap_create, which no thread 
+ *    may use any more
+ */
+void mem_heap_destroy(mem_heap_t *heap)
+{
+    mem_heap_t *cur = mem == heap ? &mem_default : mem;
+
+    mem = heap;
+    mem_deinit();
+    mem = cur;
+    free(heap);
+}
+
+/*
+ * mem_use - make the calling thread work on heap, or on the default 
+ *    model if heap is NULL
+ */
+void mem_use(mem_heap_t *heap)
+{
+    mem = heap != NULL ? heap : &mem_default;
+}
+
+/*
+ * mem_current - returns the model the calling thread works on
+ */
+mem_heap_t *mem_current()
+{
+    return mem;
 }
 
 /*
@@ -47,33 +184,80 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_release(mem->start_brk, mem->brk);
+    mem->brk = mem->start_brk;
+
+    /* while tracking, start with no page resident at all */
+    if (mem->tracking && mem->fresh > mem->start_brk) {
+	madvise(mem->start_brk, mem->fresh - mem->start_brk, MADV_DONTNEED);
+	mem->fresh = mem->start_brk;
+    }
+    mem->peak_res = 0;
+
+    /* drop every mapping too */
+    if (mem->mapped > 0) {
+	madvise(mem->map_start, MAX_MAP, MADV_DONTNEED);
+	memset(mem->map_pages, 0, MAX_MAP / mem_pagesize() * sizeof(int));
+	mem->mapped = 0;
+    }
+    mem->peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, giving its pages back if it can.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk = mem->brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (incr < 0 && mem->brk + incr < mem->start_brk) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap...\n");
+	return (void *)-1;
+    }
+    if ((mem->brk + incr) > mem->max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    mem->brk += incr;
+    if (incr < 0)
+	mem_release(mem->brk, old_brk);
+    else if (mem->brk > mem->fresh)
+	mem->fresh = mem->brk;
+    if (mem_heapsize() + mem->mapped > mem->peak)
+	mem->peak = mem_heapsize() + mem->mapped;
     return (void *)old_brk;
 }
 
+/*
+ * mem_release - with MEM_MMAP, give the whole pages in [lo, hi) back to 
+ *    the system. They read as zero when the heap grows over them again.
+ */
+static void mem_release(char *lo, char *hi)
+{
+#if MEM_MMAP
+    size_t pagesize = mem_pagesize();
+    char *start = mem->start_brk + 
+	(lo - mem->start_brk + pagesize - 1) / pagesize * pagesize;
+
+    if (hi > start) {
+	mem_sample_resident();
+	madvise(start, hi - start, MADV_DONTNEED);
+	if (hi >= mem->fresh)
+	    mem->fresh = start;
+    }
+#endif
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return (void *)mem->start_brk;
 }
 
 /* 
@@ -81,7 +265,16 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem->brk - 1);
+}
+
+/*
+ * mem_fresh_lo - return address of the first heap byte never handed out
+ *    by mem_sbrk since mem_init. Bytes from there up read as zero.
+ */
+void *mem_fresh_lo()
+{
+    return (void *)mem->fresh;
 }
 
 /*
@@ -89,7 +282,122 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(mem->brk - mem->start_brk);
+}
+
+/*
+ * mem_max_heap() - returns the most bytes the heap can grow to
+ */
+size_t mem_max_heap()
+{
+    return mem->max_heap_size;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest size in bytes of the heap 
+ *    and the mappings together since the last mem_reset_brk
+ */
+size_t mem_peak_heapsize() 
+{
+    return mem->peak;
+}
+
+/*
+ * mem_map - simple model of an anonymous mmap. Returns a page-aligned
+ *    area of size bytes, rounded up to whole pages, from the first run of
+ *    free pages in the region.
+ */
+void *mem_map(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    int npages = (size + pagesize - 1) / pagesize;
+    int maxpages = MAX_MAP / pagesize;
+    int i = 0, run = 0;
+
+    if (size == 0 || size > MAX_MAP) {  /* no pages, or npages wrapped */
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    while (i + run < maxpages && run < npages) {
+	if (mem->map_pages[i + run] > 0) {  /* skip over a mapping */
+	    i += run + mem->map_pages[i + run];
+	    run = 0;
+	}
+	else
+	    run++;
+    }
+    if (run < npages) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+
+    mem->map_pages[i] = npages;
+    mem->mapped += (size_t)npages * pagesize;
+    if (mem_heapsize() + mem->mapped > mem->peak)
+	mem->peak = mem_heapsize() + mem->mapped;
+    return (void *)(mem->map_start + (size_t)i * pagesize);
+}
+
+/*
+ * mem_unmap - gives a mapping returned by mem_map back to the system
+ */
+void mem_unmap(void *ptr)
+{
+    size_t pagesize = mem_pagesize();
+    int i = ((char *)ptr - mem->map_start) / pagesize;
+    size_t size = (size_t)mem->map_pages[i] * pagesize;
+
+    mem_sample_resident();
+    madvise(ptr, size, MADV_DONTNEED);
+    mem->map_pages[i] = 0;
+    mem->mapped -= size;
+}
+
+/*
+ * mem_remap - grows the mapping at ptr to size bytes in place, like an
+ *    mremap without MREMAP_MAYMOVE. Returns 0, or -1 if the pages after
+ *    the mapping are taken.
+ */
+int mem_remap(void *ptr, size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    int i = ((char *)ptr - mem->map_start) / pagesize;
+    int npages = (size + pagesize - 1) / pagesize;
+    int j;
+
+    if (size == 0 || size > MAX_MAP)  /* no pages, or npages wrapped */
+	return -1;
+    if (npages <= mem->map_pages[i])
+	return 0;
+    if (i + npages > MAX_MAP / pagesize)
+	return -1;
+    for (j = i + mem->map_pages[i]; j < i + npages; j++)
+	if (mem->map_pages[j] > 0)
+	    return -1;
+
+    mem->mapped += (size_t)(npages - mem->map_pages[i]) * pagesize;
+    mem->map_pages[i] = npages;
+    if (mem_heapsize() + mem->mapped > mem->peak)
+	mem->peak = mem_heapsize() + mem->mapped;
+    return 0;
+}
+
+/*
+ * mem_is_mapped - is ptr inside the region of mem_map?
+ */
+int mem_is_mapped(void *ptr)
+{
+    return (char *)ptr >= mem->map_start && 
+	(char *)ptr < mem->map_start + MAX_MAP;
+}
+
+/*
+ * mem_mapsize() - returns the number of bytes mapped by mem_map
+ */
+size_t mem_mapsize()
+{
+    return mem->mapped;
 }
 
 /*
@@ -99,3 +407,63 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_track_resident - start or stop tracking the peak resident size. 
+ *    While it is tracked, mem_reset_brk gives every heap page back, so
+ *    that a run starts from nothing resident, and the resident size is
+ *    sampled each time pages are given back, which is the only time it
+ *    drops.
+ */
+void mem_track_resident(int on)
+{
+    mem->tracking = on;
+}
+
+/*
+ * mem_resident_bytes - returns the number of bytes of the heap and the 
+ *    mappings that are resident, i.e. in pages written since they were
+ *    handed out or given back
+ */
+size_t mem_resident_bytes()
+{
+    return mem_resident(mem->start_brk, mem->max_heap_size) + 
+	mem_resident(mem->map_start, MAX_MAP);
+}
+
+/*
+ * mem_peak_resident - returns the largest resident size since the last 
+ *    mem_reset_brk, sampled while tracking with mem_track_resident
+ */
+size_t mem_peak_resident()
+{
+    mem_sample_resident();
+    return mem->peak_res;
+}
+
+/*
+ * mem_resident - returns the number of resident bytes in the size bytes 
+ *    from lo, a page-aligned address, as told by mincore
+ */
+static size_t mem_resident(char *lo, size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    size_t i, npages = (size + pagesize - 1) / pagesize, n = 0;
+
+    if (mincore(lo, size, mem->res_vec) < 0)
+	return 0;
+    for (i = 0; i < npages; i++)
+	n += mem->res_vec[i] & 1;
+    return n * pagesize;
+}
+
+/*
+ * mem_sample_resident - update the peak resident size while tracking
+ */
+static void mem_sample_resident()
+{
+    size_t res;
+
+    if (mem->tracking && (res = mem_resident_bytes()) > mem->peak_res)
+	mem->peak_res = res;
+}
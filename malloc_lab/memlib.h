@@ -1,11 +1,34 @@
 #include <unistd.h>
 
+#ifndef MEM_MMAP
+#define MEM_MMAP 0 /* Give the pages of a shrunk heap back to the system */
+#endif
+
+/* A model of the memory system, see mem_use */
+typedef struct mem_heap mem_heap_t;
+
 void mem_init(void);               
+void mem_init_heap(size_t max_heap, int huge);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_fresh_lo(void);
 size_t mem_heapsize(void);
+size_t mem_max_heap(void);
+size_t mem_peak_heapsize(void);
+void *mem_map(size_t size);
+void mem_unmap(void *ptr);
+int mem_remap(void *ptr, size_t size);
+int mem_is_mapped(void *ptr);
+size_t mem_mapsize(void);
 size_t mem_pagesize(void);
+void mem_track_resident(int on);
+size_t mem_resident_bytes(void);
+size_t mem_peak_resident(void);
+mem_heap_t *mem_heap_create(size_t max_heap, int huge);
+void mem_heap_destroy(mem_heap_t *heap);
+void mem_use(mem_heap_t *heap);
+mem_heap_t *mem_current(void);
 
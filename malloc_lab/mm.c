@@ -12,18 +12,34 @@
  * In the segregated free list, nodes are divided according to 
  * the number of powers of the block size.
  * Also, each node in this list is sorted in ascending order 
- * according to the size of the block.
+ * according to the size of the block, or with MM_ORDER == MM_BY_ADDR
+ * to its address, so that the nodes walked are close together.
+ * Large sets are split again into unsorted lists by the next bits of
+ * the size, so that a fit is found in constant time by bit scan.
+ * With MM_POLICY == MM_TLSF every set is split that way, which bounds
+ * the time of every request.
+ * Requests up to SLAB_MAX bytes are served from page-sized slabs
+ * of objects of the same size, tracked by a bitmap in the slab.
  */
 #include "mm.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "memlib.h"
 
+#include "config.h"
+
+#if MM_THREADS
+#include <pthread.h>
+#endif
+
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
 
@@ -34,28 +50,95 @@
 #define WSIZE 4             /* Word and header/footer size (bytes) */
 #define DSIZE 8             /* Double word size (bytes) */
 #define CHUNKSIZE (1 << 12) /* Extend heap by this amout (bytes) */
+#define PAGE_SIZE (1 << 12) /* Arena segments and slabs never share a page */
+
+/*
+ * The heap grows by at least the arena's grow step, which starts at
+ * CHUNKSIZE. It doubles, up to 1/GROW_SHARE of the heap, when the heap
+ * grows again within GROW_BURST requests, and halves when the heap is
+ * mostly free.
+ */
+#define GROW_MIN (1 << 10)
+#define GROW_MAX (1 << 15)
+#define GROW_BURST 32
+#define GROW_SHARE 16
+
+/* Most bytes carved from one fit node by mm_malloc_batch */
+#define BATCH_BYTES CHUNKSIZE
+#define BATCH_SORT 16 /* Longest batch of mm_free_batch sorted by insertion */
 
 /* Segregated list size */
 #define LIST_SIZE 20
 
+/*
+ * Sets of LARGE_CLASS and up are split again into SL_COUNT lists by the
+ * next SL_LOG2 bits of the size. Those lists are not sorted, and a fit
+ * is found by bit scan of two level bitmaps, TLSF style.
+ */
+#if MM_POLICY == MM_TLSF
+#define LARGE_CLASS 0 /* Every set, so that no list is ever walked */
+#else
+#define LARGE_CLASS 10 /* Blocks of 1 KiB and up */
+#endif
+#define SL_LOG2 4
+#define SL_COUNT (1 << SL_LOG2)
+#define LIST_COUNT (LIST_SIZE * SL_COUNT)
+
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
 
-/* Read and write a word at address p */
+/*
+ * Header bit telling the previous block is allocated. Only free blocks
+ * have a footer, which is needed to find them when coalescing.
+ */
+#define PREV_ALLOC 0x2
+
+/*
+ * Header bit of an allocated block that has been grown by mm_realloc.
+ * Such a block is likely to grow again, so it keeps some headroom.
+ */
+#define REALLOCED 0x4
+
+/* Read and write a word at address p, logged with MM_ACCESS */
+#if MM_ACCESS
+#define GET(p) (ACCESS('L', p), *(unsigned int *)(p))
+#define PUT(p, val) (ACCESS('S', p), *(unsigned int *)(p) = (val))
+#else
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
+#endif
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
-
-/* Given block ptr bp, compute address of its header and footer */
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_REALLOCED(p) (GET(p) & REALLOCED)
+
+/* Mark the page of the header of block ptr as changed, for mm_check */
+#if MM_CHECK
+#define TOUCH(ptr) check_touch(HDRP(ptr), HDRP(ptr))
+#else
+#define TOUCH(ptr) ((void)0)
+#endif
+
+/* Write header of block ptr, keeping its previous allocated bit */
+#define SET_HDR(ptr, size, alloc) \
+    (TOUCH(ptr), PUT(HDRP(ptr), PACK(size, alloc) | GET_PREV_ALLOC(HDRP(ptr))))
+
+/* Set or clear previous allocated bit of the block after ptr */
+#define SET_NEXT_PREV_ALLOC(ptr) \
+    PUT(HDRP(NEXT_BLKP(ptr)), GET(HDRP(NEXT_BLKP(ptr))) | PREV_ALLOC)
+#define CLR_NEXT_PREV_ALLOC(ptr) \
+    PUT(HDRP(NEXT_BLKP(ptr)), GET(HDRP(NEXT_BLKP(ptr))) & ~PREV_ALLOC)
+
+/* Given block ptr bp, compute address of its header and (free) footer */
 #define HDRP(ptr) ((char *)(ptr)-WSIZE)
 #define FTRP(ptr) ((char *)(ptr) + GET_SIZE(HDRP(ptr)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous (free) blocks */
 #define NEXT_BLKP(ptr) ((char *)(ptr) + GET_SIZE((char *)(ptr)-WSIZE))
 #define PREV_BLKP(ptr) ((char *)(ptr)-GET_SIZE((char *)(ptr)-DSIZE))
 
@@ -63,72 +146,485 @@
 #define GET_PREV(ptr) ((char *)(ptr))
 #define GET_NEXT(ptr) ((char *)(ptr) + WSIZE)
 
+/*
+ * Links are 4-byte offsets from the heap base, so that a free block is
+ * still 16 bytes on 64-bit. Offset 0 is the padding word, standing for NULL.
+ */
+#define TO_PTR(off) ((off) ? mm->heap_base + (off) : NULL)
+#define TO_OFF(ptr) ((ptr) ? (unsigned int)((char *)(ptr) - mm->heap_base) : 0)
+
 /* Adjacent node in segregated list */
-#define PREV_NODE(ptr) (*(char **)(ptr))
-#define NEXT_NODE(ptr) (*(char **)(GET_NEXT(ptr)))
+#define PREV_NODE(ptr) TO_PTR(GET(ptr))
+#define NEXT_NODE(ptr) TO_PTR(GET(GET_NEXT(ptr)))
 
 /* Set pointer */
-#define SET_PTR(p, ptr) (*(unsigned int *)(p) = (unsigned int)(ptr))
+#define SET_PTR(p, ptr) PUT(p, TO_OFF(ptr))
+
+/* Fetch the links of node ptr into the cache ahead of their use */
+#if MM_PREFETCH
+#define PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define PREFETCH(ptr)
+#endif
+
+/* Whether node ptr of size bytes goes after node in a sorted list */
+#if MM_ORDER == MM_BY_ADDR
+#define GOES_AFTER(ptr, size, node) ((char *)(ptr) > (char *)(node))
+#else
+#define GOES_AFTER(ptr, size, node) ((size) > GET_SIZE(HDRP(node)))
+#endif
+
+/* Link of a block in a singly linked stack, stored in its payload */
+#define LINK(ptr) (*(void **)(ptr))
+
+/* Free a block given back by the user, deferred with MM_DEFER */
+#if MM_DEFER
+#define USER_FREE(ptr) quick_free(ptr)
+#else
+#define USER_FREE(ptr) free_block(ptr)
+#endif
+
+/*
+ * Slab - a page-aligned block of PAGE_SIZE bytes holding objects of one
+ * size class up to SLAB_MAX bytes, without per-object header or footer.
+ */
+#define SLAB_MAX 64                     /* Largest request served by slabs */
+#define SLAB_CLASSES (SLAB_MAX / DSIZE) /* Object sizes 8, 16, .. SLAB_MAX */
+#define SLAB_WORDS 16                   /* Free bitmap words of a slab */
+
+#define SLAB_CLASS(size) (((size) - 1) / DSIZE)
+#define SLAB_OBJ(cls) (((cls) + 1) * DSIZE)
+#define SLAB_HDR ALIGN(sizeof(slab_t))
+#define SLAB_COUNT(cls) ((PAGE_SIZE - SLAB_HDR) / SLAB_OBJ(cls))
+
+typedef struct slab {
+    struct slab *next;              /* Adjacent slab with free objects */
+    struct slab *prev;
+    unsigned short cls;             /* Size class of objects */
+    unsigned short nfree;           /* Number of free objects */
+    unsigned int map[SLAB_WORDS];   /* Bit i is set iff object i is free */
+} slab_t;
+
+#if MM_DEFER
+/*
+ * Quick bins - blocks freed by the user wait there, still marked as
+ * allocated, to be reused by a malloc of the same size. They are
+ * coalesced in one batch when QUICK_MAX of them pile up or a malloc
+ * finds no fit.
+ */
+#define QUICK_BINS 128 /* Block sizes 16 .. 1032 bytes */
+#define QUICK_MAX 64   /* Blocks deferred before a batch merge */
+#define QUICK_BIN(size) (((size) - 2 * DSIZE) / DSIZE)
+#endif
 
-/* Segregated list */
-void **segregated_free_list;
+#if MM_LIFETIME
+/*
+ * Lifetime prediction - the lifetime of blocks, counted in mallocs of
+ * their arena, is learned by size class from a sample of blocks, which
+ * are remembered by address until they are freed. A block of a class
+ * whose average lifetime is below LT_SHORT is carved from the high end
+ * of a fit node, and any other from the low end, so that short-lived
+ * blocks gather apart from long-lived ones and their holes coalesce.
+ */
+#define LT_CLASSES 512 /* Block sizes by DSIZE up to 4 KiB, then one class */
+#define LT_SAMPLES 1024 /* Blocks being measured, a power of two */
+#define LT_SHORT 16     /* Average lifetime of a short-lived class */
+#define LT_WEIGHT 8     /* A new lifetime moves the average by 1/LT_WEIGHT */
 
-#define GET_LIST(i) (*(segregated_free_list + i))
+#define LT_CLASS(size) MIN((size) / DSIZE, LT_CLASSES - 1)
+#define LT_SLOT(ptr) ((TO_OFF(ptr) / DSIZE * 2654435761u) % LT_SAMPLES)
 
-char *heap_start;
+typedef struct {
+    unsigned int off;   /* Offset of the block, 0 if the slot is free */
+    unsigned int birth; /* Clock of its arena when it was allocated */
+    unsigned int cls;   /* Class of the request */
+} lt_sample_t;
+#endif
+
+/*
+ * Arena - an independent heap made of segments carved from mem_sbrk.
+ * Each segment has its own prologue and epilogue, so blocks never
+ * coalesce across arenas.
+ */
+typedef struct {
+    void *free_list[LIST_COUNT]; /* Segregated list, SL_COUNT per set */
+    unsigned int list_map;       /* Bit i is set iff set i is non-empty */
+    unsigned int sl_map[LIST_SIZE]; /* Bit j is set iff list j of set is */
+    char *top;                  /* Epilogue header of the newest segment */
+    void *remote;               /* Blocks freed by other threads (MPSC) */
+    slab_t *slabs[SLAB_CLASSES];  /* Slabs with free objects, per class */
+    size_t heap_size;           /* Bytes of segments owned by the arena */
+    size_t free_bytes;          /* Bytes of blocks in segregated list */
+    size_t remote_frees;        /* Number of blocks pushed on remote */
+    size_t realloc_copies;      /* Reallocs that moved the payload */
+    size_t realloc_in_place;    /* Reallocs grown by a neighbour or brk */
+    size_t realloc_headroom;    /* Reallocs that fit in kept headroom */
+    size_t grow;                /* Least bytes the heap grows by */
+    size_t grow_ops;            /* Requests since the heap last grew */
+    size_t sbrk_calls;          /* Number of mem_sbrk calls */
+#if MM_DEFER
+    void *quick[QUICK_BINS];    /* Freed blocks not coalesced yet */
+    int quick_count;            /* Number of blocks in quick bins */
+#endif
+#if MM_LIFETIME
+    unsigned int clock;             /* Number of mallocs of the arena */
+    unsigned int life[LT_CLASSES];  /* Average lifetime, 0 if not known */
+    lt_sample_t sample[LT_SAMPLES]; /* Blocks whose lifetime is measured */
+    int short_lived;                /* Block being placed will die soon */
+#endif
+#if MM_THREADS
+    pthread_mutex_t lock;
+#endif
+} arena_t;
+
+/* Arena whose lists are being worked on by this thread */
+static __thread arena_t *arena;
+
+#define GET_LIST(i) (arena->free_list[i])
+
+#if MM_PROFILE
+/*
+ * Profile - counts of requests by size class, which is the set of the
+ * block size, and of the work done to serve them, since mm_init. The
+ * counters are shared by every arena, so they are bumped atomically.
+ */
+#define PROF_HIST 8 /* Search lengths 0, 1, 2-3, .. 64 and up */
+
+typedef struct {
+    size_t malloc[LIST_SIZE];  /* Requests by size class */
+    size_t free[LIST_SIZE];
+    size_t realloc[LIST_SIZE];
+    size_t searches;           /* Searches of the segregated list */
+    size_t search_nodes;       /* Nodes visited by them */
+    size_t search_max;         /* Most nodes visited by one search */
+    size_t search_hist[PROF_HIST]; /* Searches by nodes visited */
+    size_t search_misses;      /* Searches which found no fit */
+    size_t splits;             /* Fit nodes split by place */
+    size_t coalesces;          /* Free neighbours merged by coalesce */
+    size_t sbrk_calls;         /* Calls of mem_sbrk, either way */
+    size_t maps;               /* Calls of mem_map */
+} profile_t;
+
+#define PROF_CLASS(size) (getIndex(getSize(size)) / SL_COUNT)
+#define PROF_ADD(field, n) __atomic_fetch_add(&mm->profile.field, (n), __ATOMIC_RELAXED)
+#define PROF_STEP(steps) ((steps)++)
+#define PROF_SEARCH(steps, hit) prof_search(steps, hit)
+#else
+#define PROF_ADD(field, n)
+#define PROF_STEP(steps)
+#define PROF_SEARCH(steps, hit)
+#endif
+#define PROF_INC(field) PROF_ADD(field, 1)
+
+#if MM_ACCESS
+/*
+ * Access log - each header, footer and link word read or written by
+ * GET and PUT is logged as a line of a valgrind trace, so that the
+ * misses of the metadata of the heap can be counted by cache_lab/csim.
+ */
+#define ACCESS(op, p) \
+    (mm->access_log ? (void)fprintf(mm->access_log, " %c %x,%d\n", op, \
+                                (unsigned int)(size_t)(p), WSIZE) : (void)0)
+#endif
+
+/* Bits of the page map, kept for each page of the heap */
+#define PAGE_SLAB 0x80  /* Page is a slab */
+#define PAGE_ARENA 0x7f /* Mask of arena index */
+
+/* Pages are counted from the start of the heap */
+#define PAGE_INDEX(p) (((char *)(p) - mm->heap_base) / PAGE_SIZE)
+#define PAGE_START(p) (mm->heap_base + PAGE_INDEX(p) * PAGE_SIZE)
+
+#define IS_SLAB(ptr) (mm->page_map[PAGE_INDEX(ptr)] & PAGE_SLAB)
+
+/*
+ * Requests of MM_MMAP_THRESHOLD bytes and up get a mapping of their own
+ * from mem_map, which lies outside the heap. The payload of such a block
+ * lies in the first page of the mapping, DSIZE or its alignment into it,
+ * and the header holds the size of the mapping from DSIZE below it.
+ */
+#define IS_MAPPED(ptr) mem_is_mapped(ptr)
+#define MAP_START(ptr) \
+    ((char *)(((size_t)(ptr) - DSIZE) & ~(mem_pagesize() - 1)))
+
+/* A request this large would wrap around once padded, and gets no block */
+#define TOO_LARGE(size) ((size) > SIZE_MAX / 2)
+#if MM_ARENAS > 1
+#define ARENA_OF(ptr) (&mm->arenas[mm->page_map[PAGE_INDEX(ptr)] & PAGE_ARENA])
+#else
+#define ARENA_OF(ptr) (&mm->arenas[0])
+#endif
+
+/*
+ * Heap - the whole state of one instance of the allocator, which lies
+ * in a heap of memlib of its own. Each thread works on the heap it chose
+ * by mm_use, or on a default one, so that instances used by different
+ * threads are independent.
+ */
+struct mm_heap {
+    arena_t arenas[MM_ARENAS];
+    mem_heap_t *mem;         /* memlib heap it lies in, set by mm_init */
+    char *heap_base;         /* mem_heap_lo(), where offsets are taken from */
+    size_t heap_max;         /* mem_max_heap(), which sizes the tables */
+    char *tables;            /* Mapping of the tables below */
+    size_t tables_size;
+    unsigned char *page_map; /* Arena index and slab flag of each page */
+
+    /* State of mm_check, see there */
+    unsigned int *check_nodes; /* Free list nodes, a bit per DSIZE */
+    size_t check_found;        /* Free blocks met by the walk of a full check */
+#if MM_CHECK
+    unsigned int *check_dirty;  /* Changed pages, a bit per page */
+    unsigned int *check_anchor; /* First block offset of each page */
+    int check_stale;            /* Set by mm_init, before the first full check */
+#endif
+#if MM_PROFILE
+    profile_t profile;
+#endif
+#if MM_ACCESS
+    FILE *access_log;        /* Set by mm_access_log */
+#endif
+#if MM_THREADS
+    pthread_mutex_t sbrk_lock; /* mem_sbrk is shared by every arena */
+    unsigned int epoch;        /* Set by mm_init, 0 before the first one */
+    unsigned int next_arena;   /* Threads are mapped to arenas round-robin */
+#endif
+};
+
+static mm_heap_t mm_default; /* Heap of threads that never called mm_use */
+static __thread mm_heap_t *mm = &mm_default;
+
+#if MM_CHECK
+#define DIRTY(page) (mm->check_dirty[(page) / 32] >> ((page) % 32) & 1)
+#endif
+
+#if MM_THREADS
+/* An arena is shared by the threads mapped to it, so guard it with a lock */
+#define LOCK(a) (pthread_mutex_lock(&(a)->lock), arena = (a))
+#define UNLOCK(a) pthread_mutex_unlock(&(a)->lock)
+
+/* mem_sbrk is shared by every arena of a heap */
+#define SBRK_LOCK() pthread_mutex_lock(&mm->sbrk_lock)
+#define SBRK_UNLOCK() pthread_mutex_unlock(&mm->sbrk_lock)
+
+/* Thread cache of recently freed blocks, binned by exact block size */
+#define TCACHE_BINS 32 /* Cache block sizes 16 .. 264 bytes */
+#define TCACHE_FILL 8  /* Blocks moved by a refill or a flush */
+#define TCACHE_MAX 16  /* Flush a bin when it grows beyond this */
+
+#define TCACHE_BIN(size) (((size) - 2 * DSIZE) / DSIZE)
+
+/* Cached blocks stay allocated and are linked through LINK */
+typedef struct {
+    mm_heap_t *heap;            /* Heap the cached blocks belong to */
+    unsigned int epoch;         /* Its epoch when they were cached */
+    arena_t *arena;             /* Home arena of this thread */
+    void *bin[TCACHE_BINS];     /* Head of each bin */
+    int count[TCACHE_BINS];     /* Number of blocks in each bin */
+} tcache_t;
+
+static __thread tcache_t tcache;
+
+/*
+ * Bumped by each mm_init of any heap, which takes it as its epoch, so
+ * that caches of a previous heap are dropped
+ */
+static unsigned int heap_epoch;
+
+/* Flushes the cache of an exiting thread back to the shared lists */
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#else
+#define LOCK(a) (arena = (a))
+#define UNLOCK(a)
+#define SBRK_LOCK()
+#define SBRK_UNLOCK()
+#endif
+
+#if MM_LIFETIME
+#define FIND_BLOCK(size) lt_find_block(size)
+#define LT_SAMPLE(ptr, size) lt_sample(ptr, size)
+#define LT_FREE(ptr) lt_free(ptr)
+#else
+#define FIND_BLOCK(size) find_block(size)
+#define LT_SAMPLE(ptr, size)
+#define LT_FREE(ptr)
+#endif
 
 static void *extend_heap(size_t);
 static void *coalesce(void *);
 static void *place(void *, size_t);
+static int map_tables(size_t);
 static void pushNode(void *, size_t);
 static void popNode(void *);
 inline size_t getSize(size_t);
+static inline int getIndex(size_t);
 static void *realloc_coalesce(void *, size_t);
-static void check_mark_free();
-static void check_contiguous_free();
-static void check_free_in_list();
-static void check_valid_free();
-static void check_block_overlap();
-static void check_heap_address();
-static void mm_check();
-
-/* Get size which append offset */
+static int new_segment();
+static void *grow_top(size_t);
+static void *realloc_extend(void *, size_t);
+static void realloc_split(void *, size_t);
+static void *place_last(void *);
+static void *find_block(size_t);
+static void *find_fit(size_t);
+static int nextList(int);
+static size_t grow_step();
+static void *find_aligned(size_t, size_t);
+static void free_block(void *);
+static void trim_top(void *);
+static void release_block(void *);
+static void *map_block(size_t, size_t);
+static void unmap_block(void *);
+static int remap_block(void *, size_t);
+static int ptr_cmp(const void *, const void *);
+#if MM_DEFER
+static void quick_free(void *);
+static void quick_merge();
+#endif
+static void *slab_alloc(size_t);
+static void slab_free(void *);
+#if MM_LIFETIME
+static void *lt_find_block(size_t);
+static void lt_sample(void *, size_t);
+static void lt_free(void *);
+static void lt_learn(unsigned int, unsigned int);
+#endif
+#if MM_THREADS
+static void drain_remote();
+static tcache_t *tcache_get();
+static void tcache_refill(int, size_t);
+static void tcache_flush(int, int);
+static void tcache_release();
+static void tcache_destroy(void *);
+static void tcache_key_init();
+#endif
+#if MM_PROFILE
+static void prof_search(size_t, int);
+#endif
+static int check_error(void *, char *);
+static int check_lists(size_t *);
+static int check_block(char *, int, int);
+static char *check_segment(char *);
+static char *check_walk(char *, int, long);
+static int check_full();
+#if MM_CHECK
+static void check_touch(char *, char *);
+static int check_pages();
+#endif
+
+/* Get size which append header, at least a free block with footer */
 inline size_t getSize(size_t size) {
-    if (size < DSIZE)
+    if (size <= DSIZE + WSIZE)
         return 2 * DSIZE;
-    return ALIGN(size + DSIZE);
+    return ALIGN(size + WSIZE);
+}
+
+/*
+ * Get index of segregated list for the size: the set is floor(log2(size)),
+ * and large sets are split by the next SL_LOG2 bits.
+ */
+static inline int getIndex(size_t size) {
+    int i = 31 - __builtin_clz((unsigned int)size);
+
+    if (i < LARGE_CLASS)
+        return i * SL_COUNT;
+    if (i >= LIST_SIZE - 1)
+        return (LIST_SIZE - 1) * SL_COUNT +
+               MIN(size >> (LIST_SIZE - 1 - SL_LOG2), 2 * SL_COUNT - 1) - SL_COUNT;
+    return i * SL_COUNT + ((size >> (i - SL_LOG2)) & (SL_COUNT - 1));
 }
 
 static void *extend_heap(size_t size) {
-    void *ptr;
+    char *ptr;
 
     /* Allocate an even number of words to maintain alignment */
     size = ALIGN(size);
-    if ((ptr = mem_sbrk(size)) == (void *)-1)
+
+    /* Grow the newest segment while it ends at brk */
+    SBRK_LOCK();
+    if (arena->top == NULL || arena->top + WSIZE != (char *)mem_heap_hi() + 1) {
+        if (new_segment() < 0) {
+            SBRK_UNLOCK();
+            return NULL;
+        }
+    }
+    if ((ptr = grow_top(size)) == NULL) {
+        SBRK_UNLOCK();
         return NULL;
+    }
+    SBRK_UNLOCK();
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(ptr), PACK(size, 0));         /* Free block header */
+    SET_HDR(ptr, size, 0);                 /* Free block header */
     PUT(FTRP(ptr), PACK(size, 0));         /* Free block footer */
     PUT(HDRP(NEXT_BLKP(ptr)), PACK(0, 1)); /* New epilogue header */
+    arena->top = HDRP(NEXT_BLKP(ptr));
     pushNode(ptr, size);
 
     /* Coalesce if the adjacent blocks were free */
     return coalesce(ptr);
 }
 
+/* Grow the newest segment, which ends at brk, with SBRK_LOCK held */
+static void *grow_top(size_t size) {
+    char *ptr;
+
+    if ((ptr = mem_sbrk(size)) == (void *)-1)
+        return NULL;
+    arena->heap_size += size;
+    arena->sbrk_calls++;
+    PROF_INC(sbrk_calls);
+#if MM_CHECK
+    check_touch(HDRP(ptr), ptr + size - WSIZE);
+#endif
+#if MM_ARENAS > 1
+    memset(mm->page_map + PAGE_INDEX(HDRP(ptr)), arena - mm->arenas,
+           PAGE_INDEX(ptr + size - WSIZE) - PAGE_INDEX(HDRP(ptr)) + 1);
+#endif
+    return ptr;
+}
+
+/*
+ * Start a new empty segment of the arena at brk, which is page aligned
+ * when there are several arenas.
+ */
+static int new_segment() {
+    size_t pad = 0;
+    char *seg;
+
+#if MM_ARENAS > 1
+    pad = (PAGE_SIZE - mem_heapsize() % PAGE_SIZE) % PAGE_SIZE;
+#endif
+    if ((seg = mem_sbrk(pad + 4 * WSIZE)) == (void *)-1)
+        return -1;
+    arena->sbrk_calls++;
+    PROF_INC(sbrk_calls);
+#if MM_CHECK
+    check_touch(seg, seg + pad + 3 * WSIZE);
+#endif
+    seg += pad;
+
+    PUT(seg, 0);                                       /* Alignment padding */
+    PUT(seg + WSIZE, PACK(DSIZE, 1) | PREV_ALLOC);     /* Prologue header */
+    PUT(seg + (2 * WSIZE), PACK(DSIZE, 1));            /* Prologue footer */
+    PUT(seg + (3 * WSIZE), PACK(0, 1) | PREV_ALLOC);   /* Epilogue header */
+    arena->top = seg + 3 * WSIZE;
+    arena->heap_size += pad + 4 * WSIZE;
+
+    return 0;
+}
+
 /* Push pointer in segregated list */
 static void pushNode(void *ptr, size_t size) {
-    /* Find index of list */
-    int i = 0;
-    for (; i < LIST_SIZE - 1; i++) {
-        size >>= 1;
-    }
+    int i = getIndex(size);
+
+    TOUCH(ptr);
 
-    /* Find position in set of list */
+    /* Find position in set of list, large ones are pushed on the front */
     void *preNode = GET_LIST(i);
     void *node = NULL;
-    while ((preNode != NULL) && (size > GET_SIZE(HDRP(preNode)))) {
+    while (i < LARGE_CLASS * SL_COUNT && (preNode != NULL) &&
+           GOES_AFTER(ptr, size, preNode)) {
         node = preNode;
         preNode = PREV_NODE(preNode);
     }
@@ -145,25 +641,28 @@ static void pushNode(void *ptr, size_t size) {
         SET_PTR(GET_PREV(ptr), preNode);
         GET_LIST(i) = ptr;
     }
+    arena->list_map |= 1u << (i / SL_COUNT);
+    arena->sl_map[i / SL_COUNT] |= 1u << (i % SL_COUNT);
+    arena->free_bytes += size;
 
     return;
 }
 
 /* Pop node to allocate */
 static void popNode(void *ptr) {
-    size_t size = GET_SIZE(HDRP(ptr));
+    TOUCH(ptr);
+    arena->free_bytes -= GET_SIZE(HDRP(ptr));
 
     if (PREV_NODE(ptr) != NULL)
         SET_PTR(GET_NEXT(PREV_NODE(ptr)), NEXT_NODE(ptr));
     if (NEXT_NODE(ptr) != NULL)
         SET_PTR(GET_PREV(NEXT_NODE(ptr)), PREV_NODE(ptr));
     else {
-        int i = 0;
-        for (; i < LIST_SIZE - 1; i++) {
-            size >>= 1;
-        }
+        int i = getIndex(GET_SIZE(HDRP(ptr)));
 
-        GET_LIST(i) = PREV_NODE(ptr);
+        if ((GET_LIST(i) = PREV_NODE(ptr)) == NULL &&
+            (arena->sl_map[i / SL_COUNT] &= ~(1u << (i % SL_COUNT))) == 0)
+            arena->list_map &= ~(1u << (i / SL_COUNT));
     }
 
     return;
@@ -171,19 +670,20 @@ static void popNode(void *ptr) {
 
 /* Merge adjacent nodes in list */
 static void *coalesce(void *ptr) {
-    size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(ptr)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
     size_t size = GET_SIZE(HDRP(ptr));
 
     if (prev_alloc && next_alloc)
         return ptr;
 
+    PROF_ADD(coalesces, !prev_alloc + !next_alloc);
     popNode(ptr);
     if (prev_alloc && !next_alloc) {
         popNode(NEXT_BLKP(ptr));
 
         size += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-        PUT(HDRP(ptr), PACK(size, 0));
+        SET_HDR(ptr, size, 0);
         PUT(FTRP(ptr), PACK(size, 0));
     } else if (!prev_alloc && next_alloc) {
         popNode(PREV_BLKP(ptr));
@@ -191,7 +691,7 @@ static void *coalesce(void *ptr) {
         size += GET_SIZE(HDRP(PREV_BLKP(ptr)));
         PUT(FTRP(ptr), PACK(size, 0));
         ptr = PREV_BLKP(ptr);
-        PUT(HDRP(ptr), PACK(size, 0));
+        SET_HDR(ptr, size, 0);
     } else {
         popNode(PREV_BLKP(ptr));
         popNode(NEXT_BLKP(ptr));
@@ -199,7 +699,7 @@ static void *coalesce(void *ptr) {
         size += GET_SIZE(HDRP(PREV_BLKP(ptr))) + GET_SIZE(HDRP(NEXT_BLKP(ptr)));
         PUT(FTRP(NEXT_BLKP(ptr)), PACK(size, 0));
         ptr = PREV_BLKP(ptr);
-        PUT(HDRP(ptr), PACK(size, 0));
+        SET_HDR(ptr, size, 0);
     }
 
     pushNode(ptr, size);
@@ -215,14 +715,25 @@ static void *place(void *ptr, size_t size) {
     popNode(ptr);
 
     if (newSize <= DSIZE * 2) {
-        PUT(HDRP(ptr), PACK(nodeSize, 1));
-        PUT(FTRP(ptr), PACK(nodeSize, 1));
-    } else {
+        SET_HDR(ptr, nodeSize, 1);
+        SET_NEXT_PREV_ALLOC(ptr);
+#if MM_LIFETIME
+    } else if (arena->short_lived) { /* Carve it from the high end */
+        SET_HDR(ptr, newSize, 0);
+        PUT(FTRP(ptr), PACK(newSize, 0));
+        pushNode(ptr, newSize);
+        PROF_INC(splits);
+        ptr = NEXT_BLKP(ptr);
+        TOUCH(ptr);
         PUT(HDRP(ptr), PACK(size, 1));
-        PUT(FTRP(ptr), PACK(size, 1));
-        PUT(HDRP(NEXT_BLKP(ptr)), PACK(newSize, 0));
+        SET_NEXT_PREV_ALLOC(ptr);
+#endif
+    } else {
+        SET_HDR(ptr, size, 1);
+        PUT(HDRP(NEXT_BLKP(ptr)), PACK(newSize, 0) | PREV_ALLOC);
         PUT(FTRP(NEXT_BLKP(ptr)), PACK(newSize, 0));
         pushNode(NEXT_BLKP(ptr), newSize);
+        PROF_INC(splits);
     }
     return ptr;
 }
@@ -231,86 +742,857 @@ static void *place(void *ptr, size_t size) {
  * mm_init - initialize the malloc package.
  */
 int mm_init(void) {
-    /* Initialize segregated list */
-    if ((segregated_free_list = mem_sbrk(LIST_SIZE * WSIZE)) == (void *)-1)
-        return -1;
+    /* Initialize arenas, whose segments are created on demand */
     int i;
-    for (i = 0; i < LIST_SIZE; i++) {
-        GET_LIST(i) = NULL;
+    for (i = MM_ARENAS - 1; i >= 0; i--) {
+        arena = &mm->arenas[i];
+        memset(arena->free_list, 0, sizeof(arena->free_list));
+        arena->list_map = 0;
+        memset(arena->sl_map, 0, sizeof(arena->sl_map));
+        arena->top = NULL;
+        arena->remote = NULL;
+        memset(arena->slabs, 0, sizeof(arena->slabs));
+        arena->heap_size = arena->free_bytes = arena->remote_frees = 0;
+        arena->realloc_copies = arena->realloc_in_place = 0;
+        arena->realloc_headroom = 0;
+        arena->grow = CHUNKSIZE;
+        arena->grow_ops = arena->sbrk_calls = 0;
+#if MM_DEFER
+        memset(arena->quick, 0, sizeof(arena->quick));
+        arena->quick_count = 0;
+#endif
+#if MM_LIFETIME
+        arena->clock = 0;
+        memset(arena->life, 0, sizeof(arena->life));
+        memset(arena->sample, 0, sizeof(arena->sample));
+        arena->short_lived = 0;
+#endif
+#if MM_THREADS
+        if (mm->epoch == 0)
+            pthread_mutex_init(&arena->lock, NULL);
+#endif
     }
+#if MM_THREADS
+    if (mm->epoch == 0) /* extend_heap below takes it */
+        pthread_mutex_init(&mm->sbrk_lock, NULL);
+#endif
 
-    /* Create the initial empty heap */
-    if ((heap_start = mem_sbrk(4 * WSIZE)) == (void *)-1)
+    /* Offsets of links are 32 bits, which bounds the heap */
+    if (mem_max_heap() > UINT_MAX)
         return -1;
-
-    PUT(heap_start, 0);                            /* Alignment padding */
-    PUT(heap_start + WSIZE, PACK(DSIZE, 1));       /* Prologue header */
-    PUT(heap_start + (2 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
-    PUT(heap_start + (3 * WSIZE), PACK(0, 1));     /* Epilogue header */
-
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (mem_max_heap() != mm->heap_max && map_tables(mem_max_heap()) < 0)
+        return -1;
+    memset(mm->page_map, 0, mm->heap_max / PAGE_SIZE);
+    mm->heap_base = mem_heap_lo();
+    mm->mem = mem_current();
+#if MM_PROFILE
+    memset(&mm->profile, 0, sizeof(mm->profile));
+#endif
+#if MM_CHECK
+    mm->check_stale = 1;
+#endif
+
+    /* Create the initial heap with a free block of CHUNKSIZE bytes */
     if (extend_heap(CHUNKSIZE / DSIZE) == NULL)
         return -1;
 
+#if MM_THREADS
+    mm->epoch = __atomic_add_fetch(&heap_epoch, 1, __ATOMIC_RELAXED);
+#endif
+
     return 0;
 }
 
-/* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+/*
+ * Map the tables kept for each page or double word of a heap of max
+ * bytes at most, which memlib sets at run time. They are mapped from the
+ * system apart from the heap, and only the pages of them that are used
+ * get backed, so a large heap limit costs address space only.
  */
-void *mm_malloc(size_t size) {
-    if (size == 0)
+static int map_tables(size_t max) {
+    size_t pages = max / PAGE_SIZE;
+    size_t size = max / DSIZE / 8 + pages;
+    char *p;
+
+#if MM_CHECK
+    size += pages * sizeof(unsigned int) + pages / 8;
+#endif
+    if (mm->tables != NULL)
+        munmap(mm->tables, mm->tables_size);
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        mm->tables = NULL;
+        mm->heap_max = 0;
+        return -1;
+    }
+    mm->tables = p;
+    mm->tables_size = size;
+    mm->heap_max = max;
+
+    /* Word tables first, which keeps them aligned as max is in pages */
+    mm->check_nodes = (unsigned int *)p;
+    p += max / DSIZE / 8;
+#if MM_CHECK
+    mm->check_anchor = (unsigned int *)p;
+    p += pages * sizeof(unsigned int);
+    mm->check_dirty = (unsigned int *)p;
+    p += pages / 8;
+#endif
+    mm->page_map = (unsigned char *)p;
+    return 0;
+}
+
+/* Find fit node in segregated list or extend the heap */
+static void *find_block(size_t size) {
+    void *node = NULL;
+
+    arena->grow_ops++;
+
+#if MM_DEFER
+    /* A deferred block of the same size is reused as it is */
+    if (QUICK_BIN(size) < QUICK_BINS && (node = arena->quick[QUICK_BIN(size)]) != NULL) {
+        arena->quick[QUICK_BIN(size)] = LINK(node);
+        arena->quick_count--;
+        return node;
+    }
+#endif
+
+    if ((node = find_fit(size)) != NULL)
+        return node;
+
+#if MM_DEFER
+    /* Merge deferred blocks and look again before growing the heap */
+    if (arena->quick_count > 0) {
+        quick_merge();
+        return find_block(size);
+    }
+#endif
+
+    // if free block is not found, extend the heap
+    if ((node = extend_heap(MAX(size, grow_step()))) == NULL)
         return NULL;
 
-    size = getSize(size);
+    return place(node, size);
+}
 
-    void *node = NULL;
-    int i = 0;
-    size_t temp = size;
-    for (; i < LIST_SIZE; i++) {
-        if (GET_LIST(i) != NULL && temp <= 1) { /* Find fit node set in list */
-            node = GET_LIST(i);
-            /* If there is no node size to allocate, pass to next set */
-            while (node != NULL && size > GET_SIZE(HDRP(node))) {
-                node = PREV_NODE(node);
+/* Place a fit node in segregated list, NULL if there is none */
+static void *find_fit(size_t size) {
+    void *node = NULL, *next;
+    int i = getIndex(size);
+#if MM_PROFILE
+    size_t steps = 0; /* Nodes visited */
+#endif
+
+    /* Own list may hold smaller nodes, so find fit node in it */
+    if ((node = GET_LIST(i)) != NULL) {
+        if (i < LARGE_CLASS * SL_COUNT ||
+            (MM_POLICY != MM_TLSF && i == LIST_COUNT - 1)) {
+            /* With MM_PREFETCH, the miss on the next node overlaps the
+               test of this one */
+            for (; node != NULL; node = next) {
+                next = PREV_NODE(node);
+                PREFETCH(next);
+                if (size <= GET_SIZE(HDRP(node)))
+                    break;
+                PROF_STEP(steps);
             }
-            if (node != NULL)
-                return place(node, size);
+        } else if (size > GET_SIZE(HDRP(node))) {
+            node = NULL; /* Only try the front of a large list */
+        }
+        if (node != NULL) {
+            PROF_SEARCH(steps, 1);
+            return place(node, size);
         }
-        temp >>= 1;
     }
 
-    // if free block is not found, extend the heap
-    if ((node = extend_heap(MAX(size, CHUNKSIZE))) == NULL)
-        return NULL;
+    /* Every node in a later list fits, so take the front of the first */
+    if ((i = nextList(i)) >= 0) {
+        PROF_SEARCH(steps, 1);
+        return place(GET_LIST(i), size);
+    }
 
-    if (0)
-        mm_check();
+    PROF_SEARCH(steps, 0);
+    return NULL;
+}
 
-    return place(node, size);
+/* Adapt the grow step of the locked arena to how often it grows */
+static size_t grow_step() {
+    if (arena->grow_ops < GROW_BURST)
+        arena->grow = MIN(arena->grow * 2,
+                          MIN(MAX(arena->heap_size / GROW_SHARE, CHUNKSIZE), GROW_MAX));
+    else if (arena->free_bytes > arena->heap_size / 2)
+        arena->grow = MAX(arena->grow / 2, GROW_MIN);
+    arena->grow_ops = 0;
+    return arena->grow;
+}
+
+/* Find the first non-empty list after list i, -1 if there is none */
+static int nextList(int i) {
+    int set = i / SL_COUNT;
+    unsigned int map = 0;
+
+    if (i % SL_COUNT != SL_COUNT - 1)
+        map = arena->sl_map[set] & (~0u << (i % SL_COUNT + 1));
+    if (map == 0) {
+        unsigned int sets =
+            set + 1 < LIST_SIZE ? arena->list_map & (~0u << (set + 1)) : 0;
+        if (sets == 0)
+            return -1;
+        set = __builtin_ctz(sets);
+        map = arena->sl_map[set];
+    }
+    return set * SL_COUNT + __builtin_ctz(map);
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * Allocate a block whose payload is aligned to align bytes. The heap
+ * starts on a page, so slabs are aligned from its start too. The block
+ * is carved from the high end of a fit node, so the space left below
+ * stays next to its lower neighbours. That fixes its place, so it is not
+ * placed by predicted lifetime; mm_aligned_alloc measures it.
  */
-void mm_free(void *ptr) {
+static void *find_aligned(size_t size, size_t align) {
+    char *ptr;
+    char *aligned;
+    size_t total;
+
+    /* Room for the leading fragment to be a whole free block */
+    if ((ptr = find_block(size + align + 2 * DSIZE)) == NULL)
+        return NULL;
+    total = GET_SIZE(HDRP(ptr));
+    aligned = (char *)((size_t)(ptr + total - size) & ~(align - 1));
+
+    TOUCH(aligned);
+    PUT(HDRP(aligned), PACK(total - (aligned - ptr), 1) | PREV_ALLOC);
+    SET_HDR(ptr, aligned - ptr, 1);
+    free_block(ptr);
+    total = GET_SIZE(HDRP(aligned));
+
+    /* Trailing fragment */
+    if (total - size >= 2 * DSIZE) {
+        SET_HDR(aligned, size, 1);
+        PUT(HDRP(NEXT_BLKP(aligned)), PACK(total - size, 1) | PREV_ALLOC);
+        free_block(NEXT_BLKP(aligned));
+    }
+
+    return aligned;
+}
+
+/* Allocate an object from a slab of its size class */
+static void *slab_alloc(size_t size) {
+    int cls = SLAB_CLASS(size);
+    slab_t *slab = arena->slabs[cls];
+    int i, w;
+
+    if (slab == NULL) { /* Carve a new slab out of the heap */
+        if ((slab = find_aligned(getSize(PAGE_SIZE), PAGE_SIZE)) == NULL)
+            return NULL;
+        mm->page_map[PAGE_INDEX(slab)] |= PAGE_SLAB;
+
+        slab->next = slab->prev = NULL;
+        slab->cls = cls;
+        slab->nfree = SLAB_COUNT(cls);
+        memset(slab->map, 0, sizeof(slab->map));
+        for (i = 0; i < SLAB_COUNT(cls); i++)
+            slab->map[i / 32] |= 1u << (i % 32);
+        arena->slabs[cls] = slab;
+    }
+
+    for (w = 0; slab->map[w] == 0; w++)
+        ;
+    i = __builtin_ctz(slab->map[w]);
+    slab->map[w] &= ~(1u << i);
+
+    /* A full slab leaves the list until an object is freed */
+    if (--slab->nfree == 0) {
+        if ((arena->slabs[cls] = slab->next) != NULL)
+            slab->next->prev = NULL;
+    }
+
+    return (char *)slab + SLAB_HDR + (w * 32 + i) * SLAB_OBJ(cls);
+}
+
+/* Return an object to its slab in the locked arena */
+static void slab_free(void *ptr) {
+    slab_t *slab = (slab_t *)PAGE_START(ptr);
+    int cls = slab->cls;
+    int i = ((char *)ptr - (char *)slab - SLAB_HDR) / SLAB_OBJ(cls);
+
+    slab->map[i / 32] |= 1u << (i % 32);
+    if (slab->nfree++ == 0) {
+        slab->prev = NULL;
+        if ((slab->next = arena->slabs[cls]) != NULL)
+            slab->next->prev = slab;
+        arena->slabs[cls] = slab;
+    }
+
+    /* Give an empty slab back to the heap, unless it is the last one */
+    if (slab->nfree == SLAB_COUNT(cls) && (slab->next || slab->prev)) {
+        if (slab->prev != NULL)
+            slab->prev->next = slab->next;
+        else
+            arena->slabs[cls] = slab->next;
+        if (slab->next != NULL)
+            slab->next->prev = slab->prev;
+        mm->page_map[PAGE_INDEX(slab)] &= ~PAGE_SLAB;
+        free_block(slab);
+    }
+}
+
+/* Return a block to segregated list */
+static void free_block(void *ptr) {
     size_t size = GET_SIZE(HDRP(ptr));
-    PUT(HDRP(ptr), PACK(size, 0));
+    SET_HDR(ptr, size, 0);
     PUT(FTRP(ptr), PACK(size, 0));
+    CLR_NEXT_PREV_ALLOC(ptr);
 
     pushNode(ptr, size);
 
-    coalesce(ptr);
+    trim_top(coalesce(ptr));
 
     // mm_check();
+}
+
+/*
+ * Give a free block ending the heap at brk back to memlib when it is
+ * MM_TRIM_THRESHOLD bytes or more, keeping CHUNKSIZE bytes of it.
+ */
+static void trim_top(void *ptr) {
+    size_t size = GET_SIZE(HDRP(ptr));
+    size_t trim = size - CHUNKSIZE;
+
+    if (size < MM_TRIM_THRESHOLD || HDRP(NEXT_BLKP(ptr)) != arena->top)
+        return;
+
+    SBRK_LOCK();
+    if (arena->top + WSIZE == (char *)mem_heap_hi() + 1 &&
+        mem_sbrk(-(int)trim) != (void *)-1) {
+        arena->heap_size -= trim;
+        popNode(ptr);
+        arena->sbrk_calls++;
+        PROF_INC(sbrk_calls);
+#if MM_CHECK
+        check_touch(HDRP(ptr), HDRP(ptr) + size);
+#endif
+        SET_HDR(ptr, CHUNKSIZE, 0);
+        PUT(FTRP(ptr), PACK(CHUNKSIZE, 0));
+        PUT(HDRP(NEXT_BLKP(ptr)), PACK(0, 1)); /* New epilogue header */
+        arena->top = HDRP(NEXT_BLKP(ptr));
+        pushNode(ptr, CHUNKSIZE);
+    }
+    SBRK_UNLOCK();
+}
+
+/* Return a block to the arena owning it */
+static void release_block(void *ptr) {
+    arena_t *a = ARENA_OF(ptr);
+
+#if MM_THREADS
+    /* Others' blocks go on the owner's remote list, drained by its malloc */
+    if (a != tcache.arena) {
+        void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+        do {
+            LINK(ptr) = head;
+        } while (!__atomic_compare_exchange_n(&a->remote, &head, ptr, 1,
+                                              __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+        __atomic_fetch_add(&a->remote_frees, 1, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+
+    LOCK(a);
+    if (IS_SLAB(ptr)) {
+        slab_free(ptr);
+    } else {
+        LT_FREE(ptr);
+        USER_FREE(ptr);
+    }
+    UNLOCK(a);
+}
+
+#if MM_DEFER
+/* Put a block freed by the user in a quick bin of the locked arena */
+static void quick_free(void *ptr) {
+    size_t size = GET_SIZE(HDRP(ptr));
+    int b = QUICK_BIN(size);
+
+    if (b >= QUICK_BINS) {
+        free_block(ptr);
+        return;
+    }
+    PUT(HDRP(ptr), GET(HDRP(ptr)) & ~REALLOCED);
+    LINK(ptr) = arena->quick[b];
+    arena->quick[b] = ptr;
+    if (++arena->quick_count > QUICK_MAX)
+        quick_merge();
+}
+
+/* Free and coalesce every block in the quick bins of the locked arena */
+static void quick_merge() {
+    int b;
+
+    for (b = 0; b < QUICK_BINS && arena->quick_count > 0; b++) {
+        while (arena->quick[b] != NULL) {
+            void *ptr = arena->quick[b];
+            arena->quick[b] = LINK(ptr);
+            arena->quick_count--;
+            free_block(ptr);
+        }
+    }
+}
+#endif
+
+/*
+ * Give a huge request a mapping of its own, with its payload aligned to
+ * align bytes, DSIZE or a power of two up to a page
+ */
+static void *map_block(size_t size, size_t align) {
+    size_t offset = MAX(align, DSIZE);
+    size_t mapSize;
+    char *ptr;
+
+    if (TOO_LARGE(size))
+        return NULL;
+    mapSize = (size + offset + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    SBRK_LOCK();
+    ptr = mem_map(mapSize);
+    SBRK_UNLOCK();
+    PROF_INC(maps);
+    if (ptr == (void *)-1)
+        return NULL;
+
+    ptr += offset;
+    PUT(HDRP(ptr), PACK(mapSize - (offset - DSIZE), 1));
+    return ptr;
+}
+
+/* Grow the mapping of a huge block in place if the pages after it are free */
+static int remap_block(void *ptr, size_t size) {
+    char *start = MAP_START(ptr);
+    size_t offset = (char *)ptr - start;
+    size_t mapSize;
+    int ok;
+
+    if (TOO_LARGE(size))
+        return 0;
+    mapSize = (size + offset + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    SBRK_LOCK();
+    ok = mem_remap(start, mapSize) == 0;
+    SBRK_UNLOCK();
+    if (ok)
+        PUT(HDRP(ptr), PACK(mapSize - (offset - DSIZE), 1));
+    return ok;
+}
+
+/* Give the mapping of a huge block back */
+static void unmap_block(void *ptr) {
+    SBRK_LOCK();
+    mem_unmap(MAP_START(ptr));
+    SBRK_UNLOCK();
+}
+
+#if MM_THREADS
+/* Free the blocks other threads returned to the locked arena */
+static void drain_remote() {
+    void *ptr = __atomic_exchange_n(&arena->remote, NULL, __ATOMIC_ACQUIRE);
+
+    while (ptr != NULL) {
+        void *next = LINK(ptr);
+        if (IS_SLAB(ptr)) {
+            slab_free(ptr);
+        } else {
+            LT_FREE(ptr);
+            USER_FREE(ptr);
+        }
+        ptr = next;
+    }
+}
+#endif
+
+#if MM_LIFETIME
+/*
+ * Find a block of size bytes in the locked arena, placed as its class
+ * is predicted to live, and measure its lifetime.
+ */
+static void *lt_find_block(size_t size) {
+    unsigned int cls = LT_CLASS(size);
+    void *ptr;
+
+    arena->short_lived = arena->life[cls] != 0 && arena->life[cls] < LT_SHORT;
+    ptr = find_block(size);
+    arena->short_lived = 0;
+    if (ptr != NULL)
+        lt_sample(ptr, size);
+    return ptr;
+}
+
+/*
+ * Count a block of size bytes allocated from the locked arena, and
+ * measure its lifetime if its sample slot is free. A block measured for
+ * long is taken to be long-lived, and its slot given to the new one.
+ */
+static void lt_sample(void *ptr, size_t size) {
+    lt_sample_t *sample = &arena->sample[LT_SLOT(ptr)];
+
+    arena->clock++;
+    if (sample->off != 0) {
+        if (arena->clock - sample->birth < LT_SHORT * LT_WEIGHT)
+            return;
+        lt_learn(sample->cls, arena->clock - sample->birth);
+    }
+    sample->off = TO_OFF(ptr);
+    sample->birth = arena->clock;
+    sample->cls = LT_CLASS(size);
+}
+
+/* Learn the lifetime of a block freed to the locked arena, if measured */
+static void lt_free(void *ptr) {
+    lt_sample_t *sample = &arena->sample[LT_SLOT(ptr)];
+
+    if (sample->off == TO_OFF(ptr)) {
+        lt_learn(sample->cls, arena->clock - sample->birth);
+        sample->off = 0;
+    }
+}
+
+/* Move the average lifetime of a class towards a new one */
+static void lt_learn(unsigned int cls, unsigned int life) {
+    int avg = arena->life[cls];
+
+    life = MIN(life, LT_SHORT * LT_WEIGHT) + 1;
+    arena->life[cls] = avg == 0 ? life : avg + ((int)life - avg) / LT_WEIGHT;
+}
+#endif
+
+/* 
+ * mm_malloc - Allocate a block by incrementing the brk pointer.
+ *     Always allocate a block whose size is a multiple of the alignment.
+ */
+void *mm_malloc(size_t size) {
+    void *ptr;
+
+    if (size == 0)
+        return NULL;
+    PROF_INC(malloc[PROF_CLASS(size)]);
+    if (size >= MM_MMAP_THRESHOLD)
+        return map_block(size, DSIZE);
+
+#if MM_THREADS
+    tcache_t *tc = tcache_get();
+    size_t asize = getSize(size);
+
+    if (size > SLAB_MAX && TCACHE_BIN(asize) < TCACHE_BINS) {
+        int b = TCACHE_BIN(asize);
+
+        if (tc->bin[b] == NULL)
+            tcache_refill(b, asize);
+        if (tc->bin[b] != NULL) {
+            ptr = tc->bin[b];
+            tc->bin[b] = LINK(ptr);
+            tc->count[b]--;
+            return ptr;
+        }
+    }
+
+    LOCK(tc->arena);
+    drain_remote();
+#endif
+    if (size <= SLAB_MAX)
+        ptr = slab_alloc(size);
+    else
+        ptr = FIND_BLOCK(getSize(size));
+    UNLOCK(arena);
+
+    return ptr;
+}
+
+/*
+ * mm_free - Freeing a block does nothing.
+ */
+void mm_free(void *ptr) {
+    if (ptr == NULL)
+        return;
+    PROF_INC(free[PROF_CLASS(mm_usable_size(ptr))]);
+    if (IS_MAPPED(ptr)) {
+        unmap_block(ptr);
+        return;
+    }
+
+#if MM_THREADS
+    tcache_t *tc = tcache_get();
+    size_t size = IS_SLAB(ptr) ? 0 : GET_SIZE(HDRP(ptr));
+
+    if (size != 0 && TCACHE_BIN(size) < TCACHE_BINS) {
+        int b = TCACHE_BIN(size);
+
+        PUT(HDRP(ptr), GET(HDRP(ptr)) & ~REALLOCED);
+        LINK(ptr) = tc->bin[b];
+        tc->bin[b] = ptr;
+        if (++tc->count[b] > TCACHE_MAX)
+            tcache_flush(b, TCACHE_FILL);
+        return;
+    }
+#endif
+
+    release_block(ptr);
 
     return;
 }
 
+/*
+ * mm_free_sized - Free a block of size bytes, the size asked of the mm
+ *     package. A block of more than SLAB_MAX bytes is no slab object,
+ *     so the page map is not looked up.
+ */
+void mm_free_sized(void *ptr, size_t size) {
+    if (MM_THREADS || ptr == NULL || size <= SLAB_MAX || IS_MAPPED(ptr)) {
+        mm_free(ptr);
+        return;
+    }
+
+    PROF_INC(free[PROF_CLASS(size)]);
+    LOCK(ARENA_OF(ptr));
+    LT_FREE(ptr);
+    USER_FREE(ptr);
+    UNLOCK(arena);
+}
+
+/*
+ * mm_free_batch - Free n blocks at once. Heap blocks are sorted by
+ *     address, so that a run of adjacent blocks is freed and coalesced
+ *     as one block. Each arena is locked once per run of its blocks.
+ *     The order of ptrs is not kept.
+ */
+void mm_free_batch(void **ptrs, int n) {
+    arena_t *a = NULL;
+    char *ptr;
+    size_t size;
+    int i, j, m = 0;
+
+    /* Mappings and slab objects go first, which need no sorting */
+    for (i = 0; i < n; i++) {
+        ptr = ptrs[i];
+        if (ptr == NULL)
+            continue;
+        PROF_INC(free[PROF_CLASS(mm_usable_size(ptr))]);
+        if (IS_MAPPED(ptr)) {
+            unmap_block(ptr);
+        } else if (IS_SLAB(ptr)) {
+            if (ARENA_OF(ptr) != a) {
+                if (a != NULL)
+                    UNLOCK(a);
+                a = ARENA_OF(ptr);
+                LOCK(a);
+            }
+            slab_free(ptr);
+        } else {
+            ptrs[m++] = ptr;
+        }
+    }
+
+    /*
+     * Blocks freed in the order they were allocated are often sorted
+     * already. Others are sorted by insertion if there are few of them.
+     */
+    for (i = 1; i < m && (char *)ptrs[i - 1] < (char *)ptrs[i]; i++)
+        ;
+    if (i < m && m > BATCH_SORT) {
+        qsort(ptrs, m, sizeof(void *), ptr_cmp);
+    } else {
+        for (; i < m; i++) {
+            ptr = ptrs[i];
+            for (j = i; j > 0 && (char *)ptrs[j - 1] > ptr; j--)
+                ptrs[j] = ptrs[j - 1];
+            ptrs[j] = ptr;
+        }
+    }
+
+    for (i = 0; i < m; i = j) {
+        ptr = ptrs[i];
+        if (ARENA_OF(ptr) != a) {
+            if (a != NULL)
+                UNLOCK(a);
+            a = ARENA_OF(ptr);
+            LOCK(a);
+        }
+
+        /* Blocks following it are merged into it, then freed in one go */
+        size = GET_SIZE(HDRP(ptr));
+        LT_FREE(ptr);
+        for (j = i + 1; j < m && (char *)ptrs[j] == ptr + size; j++) {
+            TOUCH(ptrs[j]);
+            LT_FREE(ptrs[j]);
+            size += GET_SIZE(HDRP(ptrs[j]));
+        }
+        if (j == i + 1) {
+            USER_FREE(ptr);
+        } else {
+            SET_HDR(ptr, size, 1);
+            free_block(ptr);
+        }
+    }
+    if (a != NULL)
+        UNLOCK(a);
+}
+
+/* Order blocks by address for mm_free_batch */
+static int ptr_cmp(const void *a, const void *b) {
+    char *p = *(char **)a;
+    char *q = *(char **)b;
+
+    return (p > q) - (p < q);
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out, and return
+ *     how many were allocated. Heap blocks are split from one fit node
+ *     per BATCH_BYTES, so that the lists are searched once for them all.
+ *     While no node is that large, they are allocated one by one, so
+ *     that small free blocks are used before the heap grows.
+ */
+int mm_malloc_batch(size_t size, int n, void **out) {
+    size_t asize = getSize(size);
+    size_t total;
+    char *ptr;
+    int i = 0, k, count;
+
+    if (size == 0)
+        return 0;
+    PROF_ADD(malloc[PROF_CLASS(size)], n);
+    if (size >= MM_MMAP_THRESHOLD) {
+        while (i < n && (out[i] = map_block(size, DSIZE)) != NULL)
+            i++;
+        return i;
+    }
+
+#if MM_THREADS
+    LOCK(tcache_get()->arena);
+    drain_remote();
+#endif
+    if (size <= SLAB_MAX) {
+        while (i < n && (out[i] = slab_alloc(size)) != NULL)
+            i++;
+    }
+    while (size > SLAB_MAX && i < n) {
+        count = MIN(n - i, MAX(BATCH_BYTES / asize, 1));
+        if ((ptr = find_fit(count * asize)) == NULL) {
+            if ((out[i] = FIND_BLOCK(asize)) == NULL)
+                break;
+            i++;
+            continue;
+        }
+
+        /* A run shares one node, so it is measured but not placed apart.
+           The last block takes what place left over */
+        total = GET_SIZE(HDRP(ptr));
+        for (k = 1; k < count; k++) {
+            SET_HDR(ptr, asize, 1);
+            LT_SAMPLE(ptr, asize);
+            out[i++] = ptr;
+            ptr = NEXT_BLKP(ptr);
+            TOUCH(ptr);
+            PUT(HDRP(ptr), PACK(total - k * asize, 1) | PREV_ALLOC);
+        }
+        LT_SAMPLE(ptr, asize);
+        out[i++] = ptr;
+    }
+    UNLOCK(arena);
+
+    return i;
+}
+
+#if MM_THREADS
+/* Get cache of this thread, dropping blocks of a reinitialized heap */
+static tcache_t *tcache_get() {
+    if (tcache.heap != mm || tcache.epoch != mm->epoch) {
+        pthread_once(&tcache_once, tcache_key_init);
+        pthread_setspecific(tcache_key, &tcache);
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.heap = mm;
+        tcache.epoch = mm->epoch;
+        tcache.arena = &mm->arenas[__atomic_fetch_add(&mm->next_arena, 1,
+                                                  __ATOMIC_RELAXED) %
+                               MM_ARENAS];
+    }
+    return &tcache;
+}
+
+/* Move a batch of fresh blocks of the size into an empty bin */
+static void tcache_refill(int b, size_t size) {
+    int i;
+
+    LOCK(tcache.arena);
+    drain_remote();
+    for (i = 0; i < TCACHE_FILL / 2; i++) {
+        void *ptr = find_block(size);
+        if (ptr == NULL)
+            break;
+        LINK(ptr) = tcache.bin[b];
+        tcache.bin[b] = ptr;
+        tcache.count[b]++;
+    }
+    UNLOCK(arena);
+}
+
+/* Return up to n blocks of a bin to the arenas owning them */
+static void tcache_flush(int b, int n) {
+    void *remote = NULL;
+
+    /* Own blocks are freed under one lock, the rest afterwards */
+    LOCK(tcache.arena);
+    while (n-- > 0 && tcache.bin[b] != NULL) {
+        void *ptr = tcache.bin[b];
+        tcache.bin[b] = LINK(ptr);
+        tcache.count[b]--;
+        if (ARENA_OF(ptr) == arena) {
+            LT_FREE(ptr);
+            USER_FREE(ptr);
+        } else {
+            LINK(ptr) = remote;
+            remote = ptr;
+        }
+    }
+    UNLOCK(arena);
+
+    while (remote != NULL) {
+        void *next = LINK(remote);
+        release_block(remote);
+        remote = next;
+    }
+}
+
+/* Hand every cached block back to the heap it came from, if still live */
+static void tcache_release() {
+    mm_heap_t *cur = mm;
+    mem_heap_t *mem = mem_current();
+    int b;
+
+    if (tcache.heap != NULL && tcache.epoch == tcache.heap->epoch) {
+        mm = tcache.heap;
+        mem_use(mm->mem);
+        for (b = 0; b < TCACHE_BINS; b++)
+            tcache_flush(b, tcache.count[b]);
+        mm = cur;
+        mem_use(mem);
+    }
+    tcache.heap = NULL;
+}
+
+/* Thread exit: hand every cached block back to segregated list */
+static void tcache_destroy(void *arg) {
+    tcache_release();
+}
+
+static void tcache_key_init() {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+#endif
+
 /* Merge adjacent nodes in list when reallocating */
 static void *realloc_coalesce(void *ptr, size_t newSize) {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(ptr)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
     size_t size = GET_SIZE(HDRP(ptr));
 
@@ -318,33 +1600,101 @@ static void *realloc_coalesce(void *ptr, size_t newSize) {
         size += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
         if (size >= newSize) {
             popNode(NEXT_BLKP(ptr));
-            PUT(HDRP(ptr), PACK(size, 1));
-            PUT(FTRP(ptr), PACK(size, 1));
+            SET_HDR(ptr, size, 1);
+            SET_NEXT_PREV_ALLOC(ptr);
             return ptr;
         }
     } else if (!prev_alloc && next_alloc) {
         size += GET_SIZE(HDRP(PREV_BLKP(ptr)));
         if (size >= newSize) {
+            TOUCH(ptr); /* Its header is gone */
             popNode(PREV_BLKP(ptr));
-            PUT(FTRP(ptr), PACK(size, 1));
-            PUT(HDRP(PREV_BLKP(ptr)), PACK(size, 1));
             ptr = PREV_BLKP(ptr);
+            SET_HDR(ptr, size, 1);
             return ptr;
         }
     } else if (!prev_alloc && !next_alloc) {
-        size += GET_SIZE(FTRP(NEXT_BLKP(ptr))) + GET_SIZE(HDRP(PREV_BLKP(ptr)));
+        size += GET_SIZE(HDRP(NEXT_BLKP(ptr))) + GET_SIZE(HDRP(PREV_BLKP(ptr)));
         if (size >= newSize) {
+            TOUCH(ptr);
             popNode(PREV_BLKP(ptr));
             popNode(NEXT_BLKP(ptr));
-            PUT(FTRP(NEXT_BLKP(ptr)), PACK(size, 1));
-            PUT(HDRP(PREV_BLKP(ptr)), PACK(size, 1));
             ptr = PREV_BLKP(ptr);
+            SET_HDR(ptr, size, 1);
+            SET_NEXT_PREV_ALLOC(ptr);
             return ptr;
         }
     }
     return NULL;
 }
 
+/*
+ * Move a block just placed at the front of the last free block of the
+ * newest segment to its end, so that it can grow into brk in place.
+ */
+static void *place_last(void *ptr) {
+    char *next = NEXT_BLKP(ptr);
+    size_t size = GET_SIZE(HDRP(ptr));
+    size_t nextSize = GET_SIZE(HDRP(next));
+
+    if (GET_ALLOC(HDRP(next)) || HDRP(NEXT_BLKP(next)) != arena->top)
+        return ptr;
+
+    popNode(next);
+    SET_HDR(ptr, nextSize, 0);
+    PUT(FTRP(ptr), PACK(nextSize, 0));
+    pushNode(ptr, nextSize);
+
+    next = NEXT_BLKP(ptr);
+    TOUCH(next);
+    PUT(HDRP(next), PACK(size, 1));
+    SET_NEXT_PREV_ALLOC(next);
+    return next;
+}
+
+/* Free the tail of an allocated block beyond size if it makes a block */
+static void realloc_split(void *ptr, size_t size) {
+    size_t oldsize = GET_SIZE(HDRP(ptr));
+
+    if (oldsize < size + 2 * DSIZE)
+        return;
+    SET_HDR(ptr, size, 1);
+    PUT(HDRP(NEXT_BLKP(ptr)), PACK(oldsize - size, 1) | PREV_ALLOC);
+    free_block(NEXT_BLKP(ptr));
+}
+
+/*
+ * Grow the last block of the newest segment in place, extending the
+ * heap by just the bytes it lacks.
+ */
+static void *realloc_extend(void *ptr, size_t newSize) {
+    char *next = NEXT_BLKP(ptr);
+    size_t size = GET_SIZE(HDRP(ptr));
+
+    /* A free block may lie between it and the epilogue */
+    if (!GET_ALLOC(HDRP(next))) {
+        size += GET_SIZE(HDRP(next));
+        next = NEXT_BLKP(next);
+    }
+    if (HDRP(next) != arena->top || size >= newSize)
+        return NULL;
+
+    SBRK_LOCK();
+    if (arena->top + WSIZE != (char *)mem_heap_hi() + 1 ||
+        grow_top(newSize - size) == NULL) {
+        SBRK_UNLOCK();
+        return NULL;
+    }
+    SBRK_UNLOCK();
+
+    if (size != GET_SIZE(HDRP(ptr)))
+        popNode(NEXT_BLKP(ptr));
+    SET_HDR(ptr, newSize, 1);
+    PUT(HDRP(NEXT_BLKP(ptr)), PACK(0, 1) | PREV_ALLOC); /* New epilogue */
+    arena->top = HDRP(NEXT_BLKP(ptr));
+    return ptr;
+}
+
 /*
  * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
  */
@@ -355,169 +1705,598 @@ void *mm_realloc(void *ptr, size_t size) {
         mm_free(ptr);
         return NULL;
     }
+    if (TOO_LARGE(size))
+        return NULL;
+    PROF_INC(realloc[PROF_CLASS(size)]);
+
+    /* A mapped block stays in its mapping while it fits */
+    if (IS_MAPPED(ptr)) {
+        size_t mapSize = GET_SIZE(HDRP(ptr));
+        char *new = ptr;
+        if (size > mapSize - DSIZE && !remap_block(ptr, size) &&
+            (new = mm_malloc(size)) != NULL) {
+            memcpy(new, ptr, mapSize - DSIZE);
+            mm_free(ptr);
+        }
+        return new;
+    }
+
+    /* Objects in a slab have the fixed size of their class */
+    if (IS_SLAB(ptr)) {
+        size_t objSize = SLAB_OBJ(((slab_t *)PAGE_START(ptr))->cls);
+        char *new = ptr;
+        if (size > objSize && (new = mm_malloc(size)) != NULL) {
+            memcpy(new, ptr, objSize);
+            mm_free(ptr);
+        }
+        return new;
+    }
 
     size_t newSize = getSize(size);
     size_t oldsize = GET_SIZE(HDRP(ptr));
+    size_t keepSize = newSize;
+
+    /* A block grown before keeps geometric headroom, up to a cap */
+    if (GET_REALLOCED(HDRP(ptr)))
+        keepSize = ALIGN(newSize + MIN(newSize / 2, MM_REALLOC_CAP));
+
     if (oldsize < newSize) {
-        char *new = realloc_coalesce(ptr, newSize);
+        /* Neighbours and a new block all come from the owning arena */
+        LOCK(ARENA_OF(ptr));
+        LT_FREE(ptr); /* Its lifetime in its class ends */
+        if (keepSize >= MM_MMAP_THRESHOLD) {
+            /* Grown past the threshold, it moves to a mapping */
+            char *new = map_block(keepSize, DSIZE);
+            if (new != NULL) {
+                memcpy(new, ptr, oldsize - WSIZE);
+                free_block(ptr);
+                arena->realloc_copies++;
+            }
+            UNLOCK(arena);
+            return new;
+        }
+        char *new = realloc_extend(ptr, newSize);
+        if (new == NULL)
+            new = realloc_coalesce(ptr, newSize);
         if (new == NULL) { /* If there doesn't exist adjacent node */
-            new = mm_malloc(size);
-            memcpy(new, ptr, size);
-            mm_free(ptr);
+            /* It goes where it can grow into brk, not by prediction */
+            if ((new = find_block(keepSize)) != NULL) {
+                new = place_last(new);
+                LT_SAMPLE(new, keepSize);
+                memcpy(new, ptr, oldsize - WSIZE);
+                free_block(ptr);
+                PUT(HDRP(new), GET(HDRP(new)) | REALLOCED);
+                arena->realloc_copies++;
+            }
+            UNLOCK(arena);
             return new;
         }
-        if (new != ptr)
-            memcpy(new, ptr, size);
-        PUT(HDRP(new), PACK(GET_SIZE(HDRP(new)), 1));
-        PUT(FTRP(new), PACK(GET_SIZE(HDRP(new)), 1));
+        if (new != ptr) {
+            memmove(new, ptr, oldsize - WSIZE);
+            arena->realloc_copies++;
+        } else {
+            arena->realloc_in_place++;
+        }
+        realloc_split(new, keepSize);
+        PUT(HDRP(new), GET(HDRP(new)) | REALLOCED);
+        LT_SAMPLE(new, keepSize); /* Its lifetime in the new class starts */
+        UNLOCK(arena);
         return new;
     }
 
-    /* If reallocate size is smaller than existing one, use it. */
-    PUT(HDRP(ptr), PACK(GET_SIZE(HDRP(ptr)), 1));
-    PUT(FTRP(ptr), PACK(GET_SIZE(HDRP(ptr)), 1));
+    /* If reallocate size is smaller, give the tail beyond headroom back */
+    if (oldsize >= keepSize + 2 * DSIZE) {
+        int realloced = GET_REALLOCED(HDRP(ptr));
+        LOCK(ARENA_OF(ptr));
+        realloc_split(ptr, keepSize);
+        PUT(HDRP(ptr), GET(HDRP(ptr)) | realloced);
+        UNLOCK(arena);
+    } else if (GET_REALLOCED(HDRP(ptr))) {
+        __atomic_fetch_add(&ARENA_OF(ptr)->realloc_headroom, 1, __ATOMIC_RELAXED);
+    }
 
     // mm_check();
 
     return ptr;
 }
 
-/* Is every block in the free list marked as free? */
-static void check_mark_free() {
-    int i = 0;
-    for (; i < LIST_SIZE; i++) {
-        void *ptr;
-        if ((ptr = GET_LIST(i)) != NULL)
-            while (ptr != NULL) {
-                if (GET_ALLOC(HDRP(ptr))) {
-                    printf("There is a block which marked as allocated in free list.\n");
-                    assert(0);
-                }
-                ptr = NEXT_NODE(ptr);
-            }
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes.
+ *     Heap bytes never handed out by mem_sbrk are zero already, so only
+ *     the part of the block below them and the words a free block kept
+ *     links and footer in are cleared. A chunk the heap grew by keeps
+ *     its links at the old brk even when merged into the block below,
+ *     so the clear runs up past them.
+ */
+void *mm_calloc(size_t nmemb, size_t size) {
+    size_t bytes = nmemb * size;
+    char *fresh = mem_fresh_lo();
+    char *ptr;
+    size_t low;
+
+    if (size != 0 && bytes / size != nmemb)
+        return NULL;
+    if ((ptr = mm_malloc(bytes)) == NULL || IS_MAPPED(ptr))
+        return ptr; /* A mapping reads as zero */
+
+#if MM_THREADS
+    /* Another thread may have used the fresh bytes in the meantime */
+    fresh = ptr + bytes;
+#endif
+    low = MAX(fresh + 2 * WSIZE - ptr, 2 * WSIZE); /* Below fresh, and links */
+    if (IS_SLAB(ptr) || low + DSIZE >= bytes) {
+        memset(ptr, 0, bytes);
+    } else {
+        memset(ptr, 0, low);
+        memset(ptr + bytes - DSIZE, 0, DSIZE);
     }
+    return ptr;
 }
 
-/* Are there any contiguous free blocks that somehow escaped coalescing? */
-static void check_contiguous_free() {
-    char *ptr = heap_start;
+/*
+ * mm_aligned_alloc - Allocate a block whose payload is aligned to
+ *     alignment bytes, a power of two.
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size) {
+    void *ptr;
 
-    while (GET_SIZE(HDRP(ptr)) > 0) {
-        if (!GET_ALLOC(HDRP(ptr)) && !GET_ALLOC(HDRP(NEXT_BLKP(ptr)))) {
-            size_t size = GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-            int i = 0;
-            for (; i < LIST_SIZE; i++) {
-                if (size <= 1)
-                    break;
-                size >>= 1;
-            }
+    if (alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if (size == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    PROF_INC(malloc[PROF_CLASS(size)]);
 
-            void *node = GET_LIST(i);
-            while (node != NULL) {
-                if (node == NEXT_BLKP(ptr)) {
-                    printf("There are contiguous free blocks in free list.\n");
-                    assert(0);
-                }
-                node = NEXT_NODE(node);
-            }
-        } else if (!GET_ALLOC(HDRP(ptr)) && !GET_ALLOC(HDRP(PREV_BLKP(ptr)))) {
-            size_t size = GET_SIZE(HDRP(PREV_BLKP(ptr)));
-            int i = 0;
-            for (; i < LIST_SIZE; i++) {
-                if (size <= 1)
-                    break;
-                size >>= 1;
-            }
+    /* A mapping starts on a page, so it serves alignments up to a page */
+    if (size >= MM_MMAP_THRESHOLD && alignment <= mem_pagesize())
+        return map_block(size, alignment);
+    /* Padded for its alignment, the block must fit in the heap limit */
+    if (size >= mem_max_heap() || alignment >= mem_max_heap() - size)
+        return NULL;
 
-            void *node = GET_LIST(i);
-            while (node != NULL) {
-                if (node == PREV_BLKP(ptr)) {
-                    printf("There are contiguous free blocks in free list.\n");
-                    assert(0);
-                }
-                node = NEXT_NODE(node);
-            }
-        }
-        ptr = NEXT_BLKP(ptr);
+#if MM_THREADS
+    LOCK(tcache_get()->arena);
+    drain_remote();
+#endif
+    /* Its place is set by the alignment, so it is only measured */
+    if ((ptr = find_aligned(getSize(size), alignment)) != NULL)
+        LT_SAMPLE(ptr, getSize(size));
+    UNLOCK(arena);
+
+    return ptr;
+}
+
+/*
+ * mm_usable_size - Bytes of the payload of a block, which may be more
+ *     than were asked for.
+ */
+size_t mm_usable_size(void *ptr) {
+    if (ptr == NULL)
+        return 0;
+    if (IS_MAPPED(ptr))
+        return GET_SIZE(HDRP(ptr)) - DSIZE;
+    if (IS_SLAB(ptr))
+        return SLAB_OBJ(((slab_t *)PAGE_START(ptr))->cls);
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * mm_arena_stats - Read the statistics of arena i.
+ */
+void mm_arena_stats(int i, mm_arena_stats_t *stats) {
+    stats->heap_size = mm->arenas[i].heap_size;
+    stats->free_bytes = mm->arenas[i].free_bytes;
+    stats->remote_frees = mm->arenas[i].remote_frees;
+    stats->realloc_copies = mm->arenas[i].realloc_copies;
+    stats->realloc_in_place = mm->arenas[i].realloc_in_place;
+    stats->realloc_headroom = mm->arenas[i].realloc_headroom;
+    stats->grow = mm->arenas[i].grow;
+    stats->sbrk_calls = mm->arenas[i].sbrk_calls;
+}
+
+/*
+ * mm_heap_create - Create a heap other than the default one, which is
+ * set up by mm_init once chosen by mm_use. NULL if out of memory.
+ */
+mm_heap_t *mm_heap_create(void) {
+    mm_heap_t *heap = mmap(NULL, sizeof(mm_heap_t), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return heap == MAP_FAILED ? NULL : heap;
+}
+
+/*
+ * mm_heap_destroy - Destroy a heap of mm_heap_create. Its memlib heap
+ * is left to the caller, and no thread may use it any more.
+ */
+void mm_heap_destroy(mm_heap_t *heap) {
+#if MM_THREADS
+    int i;
+
+    if (heap->epoch != 0) {
+        for (i = 0; i < MM_ARENAS; i++)
+            pthread_mutex_destroy(&heap->arenas[i].lock);
+        pthread_mutex_destroy(&heap->sbrk_lock);
     }
+    if (tcache.heap == heap)
+        tcache.heap = NULL; /* its blocks go with the heap */
+#endif
+    if (heap->tables != NULL)
+        munmap(heap->tables, heap->tables_size);
+    if (mm == heap)
+        mm = &mm_default;
+    munmap(heap, sizeof(mm_heap_t));
+}
+
+/*
+ * mm_use - Make the calling thread work on heap, and on the memlib heap
+ * it lies in, or on the default heap if heap is NULL.
+ */
+void mm_use(mm_heap_t *heap) {
+    if (heap == NULL)
+        heap = &mm_default;
+#if MM_THREADS
+    /* The blocks cached for the heap left would be lost otherwise */
+    if (tcache.heap != NULL && tcache.heap != heap)
+        tcache_release();
+#endif
+    mm = heap;
+    if (mm->mem != NULL)
+        mem_use(mm->mem);
 }
 
-/* Is every free block actually in the free list? */
-static void check_free_in_list() {
-    char *ptr = heap_start;
+/*
+ * mm_current - The heap the calling thread works on.
+ */
+mm_heap_t *mm_current(void) {
+    return mm;
+}
 
-    while (ptr != NULL && GET_SIZE(HDRP(ptr)) > 0) {
-        if (!GET_ALLOC(HDRP(ptr))) {
-            size_t size = GET_SIZE(HDRP(ptr));
-            int i = 0;
-            for (; i < LIST_SIZE; i++) {
-                if (size <= 1)
-                    break;
-                size >>= 1;
-            }
+#if MM_PROFILE
+/* Count a search of the segregated list which visited steps nodes */
+static void prof_search(size_t steps, int hit) {
+    int b = steps == 0 ? 0 : MIN(64 - __builtin_clzl(steps), PROF_HIST - 1);
+
+    PROF_INC(searches);
+    PROF_ADD(search_nodes, steps);
+    PROF_INC(search_hist[b]);
+    if (!hit)
+        PROF_INC(search_misses);
+    if (steps > mm->profile.search_max)
+        mm->profile.search_max = steps;
+}
 
-            void *node = GET_LIST(i);
-            while (node != NULL) {
-                if (node == ptr)
-                    return;
-                node = NEXT_NODE(node);
-            }
-            printf("There is a free block which is not in free list.\n");
-            assert(0);
-        }
-        ptr = NEXT_BLKP(ptr);
+/*
+ * mm_profile_dump - Print the profile of the requests since mm_init.
+ */
+void mm_profile_dump(FILE *out) {
+    profile_t *prof = &mm->profile;
+    int i;
+
+    fprintf(out, "%10s%10s%10s%10s\n", "class", "malloc", "free", "realloc");
+    for (i = 0; i < LIST_SIZE; i++) {
+        if (prof->malloc[i] + prof->free[i] + prof->realloc[i] == 0)
+            continue;
+        fprintf(out, "%6s2^%-2d%10zu%10zu%10zu\n", "", i, prof->malloc[i],
+                prof->free[i], prof->realloc[i]);
     }
+
+    fprintf(out, "searches %zu, nodes visited %zu (%.2f avg, %zu max), "
+                 "misses %zu\n",
+            prof->searches, prof->search_nodes,
+            prof->searches ? (double)prof->search_nodes / prof->searches : 0.0,
+            prof->search_max, prof->search_misses);
+    fprintf(out, "nodes visited:");
+    for (i = 0; i < PROF_HIST; i++)
+        fprintf(out, " %d%s:%zu", i == 0 ? 0 : 1 << (i - 1),
+                i == PROF_HIST - 1 ? "+" : "", prof->search_hist[i]);
+    fprintf(out, "\n");
+    fprintf(out, "splits %zu, coalesces %zu, sbrk calls %zu, maps %zu\n",
+            prof->splits, prof->coalesces, prof->sbrk_calls, prof->maps);
 }
+#endif
 
-/* Do the pointers in the free list point to valid free blocks? */
-static void check_valid_free() {
-    int i = 0;
-    for (; i < LIST_SIZE; i++) {
-        void *node = GET_LIST(i);
-        while (node != NULL) {
-            if (GET_ALLOC(HDRP(GET_NEXT(node))) || GET_ALLOC(HDRP(GET_PREV(node)))) {
-                printf("There is a free block which is not in free list.\n");
-                assert(0);
-            }
-            node = NEXT_NODE(node);
+#if MM_ACCESS
+/*
+ * mm_access_log - Log the heap accesses of mm.c to out from now on,
+ * or stop logging them if out is NULL.
+ */
+void mm_access_log(FILE *out) {
+    mm->access_log = out;
+}
+#endif
+
+/*
+ * Heap checker. A full check walks the free lists once, marking each
+ * node in a bitmap of the heap, and then the heap once, checking each
+ * block and clearing the mark of each free one. Built with MM_CHECK,
+ * the heap tracks the pages whose block headers changed, and the first
+ * block of each page is recorded by a check. An incremental check then
+ * walks from the first block of the closest unchanged page before each
+ * changed one, up to the first block of the next unchanged page, which
+ * must be where it was.
+ */
+#define CHECK_SHARE 4 /* A check is full when 1/CHECK_SHARE of pages changed */
+
+#define IN_HEAP(p) \
+    ((char *)(p) >= mm->heap_base && (char *)(p) <= (char *)mem_heap_hi())
+
+/* Word and bit of check_nodes marking a free list node at ptr */
+#define NODE_WORD(ptr) mm->check_nodes[TO_OFF(ptr) / DSIZE / 32]
+#define NODE_BIT(ptr) (1u << (TO_OFF(ptr) / DSIZE % 32))
+
+/* Report what is wrong at block ptr */
+static int check_error(void *ptr, char *msg) {
+    printf("mm_check: %s, block at offset %u\n", msg, TO_OFF(ptr));
+    return -1;
+}
+
+/* Check the lists of the current arena, marking and counting the nodes */
+static int check_lists(size_t *nodes) {
+    char *node, *next;
+    size_t size, bytes = 0;
+    int i;
+
+    for (i = 0; i < LIST_COUNT; i++) {
+        if (!(arena->list_map & 1u << (i / SL_COUNT)) != !arena->sl_map[i / SL_COUNT] ||
+            !(arena->sl_map[i / SL_COUNT] & 1u << (i % SL_COUNT)) != !GET_LIST(i))
+            return check_error(GET_LIST(i), "list bitmap is wrong");
+
+        /* Lists are linked from the head through PREV_NODE */
+        for (next = NULL, node = GET_LIST(i); node != NULL;
+             next = node, node = PREV_NODE(node)) {
+            if (!IN_HEAP(node) || (size_t)node % ALIGNMENT != 0)
+                return check_error(node, "free list node is out of the heap");
+            if (NEXT_NODE(node) != next)
+                return check_error(node, "free list links do not match");
+            if (NODE_WORD(node) & NODE_BIT(node))
+                return check_error(node, "free list has a node twice");
+            NODE_WORD(node) |= NODE_BIT(node);
+
+            size = GET_SIZE(HDRP(node));
+            if (GET_ALLOC(HDRP(node)))
+                return check_error(node, "allocated block in a free list");
+            if (getIndex(size) != i)
+                return check_error(node, "free block in the wrong list");
+            if (ARENA_OF(node) != arena)
+                return check_error(node, "free block in the list of another arena");
+            if (next != NULL && i < LARGE_CLASS * SL_COUNT &&
+                GOES_AFTER(next, GET_SIZE(HDRP(next)), node))
+                return check_error(node, "free list is not sorted");
+            bytes += size;
+            (*nodes)++;
         }
     }
+    if (bytes != arena->free_bytes)
+        return check_error(NULL, "free bytes of the arena do not add up");
+    return 0;
+}
+
+/*
+ * Check block ptr, after an allocated block iff prev_alloc. A free block
+ * is looked up in the marks of a full check, else its links are checked.
+ */
+static int check_block(char *ptr, int prev_alloc, int full) {
+    size_t size = GET_SIZE(HDRP(ptr));
+    char *prev, *next;
+
+    if ((size_t)ptr % ALIGNMENT != 0 || size < 2 * DSIZE)
+        return check_error(ptr, "block is misaligned or too small");
+    if (HDRP(ptr) + size > (char *)mem_heap_hi() + 1 - WSIZE)
+        return check_error(ptr, "block runs past the heap");
+    if (!GET_PREV_ALLOC(HDRP(ptr)) != !prev_alloc)
+        return check_error(ptr, "previous allocated bit is wrong");
+    if (GET_ALLOC(HDRP(ptr)))
+        return 0;
+
+    if (!prev_alloc)
+        return check_error(ptr, "contiguous free blocks escaped coalescing");
+    if (GET(FTRP(ptr)) != PACK(size, 0))
+        return check_error(ptr, "footer does not match header");
+    if (full) {
+        if (!(NODE_WORD(ptr) & NODE_BIT(ptr)))
+            return check_error(ptr, "free block is not in a free list");
+        NODE_WORD(ptr) &= ~NODE_BIT(ptr);
+        mm->check_found++;
+        return 0;
+    }
+
+    arena = ARENA_OF(ptr);
+    prev = PREV_NODE(ptr);
+    next = NEXT_NODE(ptr);
+    if ((prev != NULL && (!IN_HEAP(prev) || NEXT_NODE(prev) != ptr)) ||
+        (next != NULL && (!IN_HEAP(next) || PREV_NODE(next) != ptr)) ||
+        (next == NULL && GET_LIST(getIndex(size)) != ptr))
+        return check_error(ptr, "free list links do not match");
+    if (next != NULL && getIndex(GET_SIZE(HDRP(next))) != getIndex(size))
+        return check_error(ptr, "free block in the wrong list");
+    return 0;
+}
+
+/* First block of the segment at seg, after its padding and prologue */
+static char *check_segment(char *seg) {
+#if MM_ARENAS > 1
+    seg += (PAGE_SIZE - (seg - mm->heap_base) % PAGE_SIZE) % PAGE_SIZE;
+#endif
+    if (GET(seg + WSIZE) != (PACK(DSIZE, 1) | PREV_ALLOC) ||
+        GET(seg + 2 * WSIZE) != PACK(DSIZE, 1)) {
+        check_error(seg + 2 * WSIZE, "prologue is wrong");
+        return NULL;
+    }
+    return seg + 4 * WSIZE;
 }
 
-/* Do any allocated blocks overlap? */
-static void check_block_overlap() {
-    void *ptr = heap_start;
+/*
+ * Check the blocks from ptr on, whose header is in page, or page -1 to
+ * record ptr as the first block of its page, through later segments up
+ * to the end of the heap. An incremental check stops at the first block
+ * of an unchanged page. Returns where it stopped, NULL if it found the
+ * heap broken.
+ */
+static char *check_walk(char *ptr, int full, long page) {
+    char *end = (char *)mem_heap_hi() + 1;
+    int prev_alloc = GET_PREV_ALLOC(HDRP(ptr)) != 0;
+    long p;
+
+    while (1) {
+        /* The first block in each page is where a later walk can start */
+        if ((p = PAGE_INDEX(HDRP(ptr))) != page) {
+#if MM_CHECK
+            for (page++; page < p; page++) {
+                if (!full && !DIRTY(page) && mm->check_anchor[page] != 0) {
+                    check_error(TO_PTR(mm->check_anchor[page]),
+                                "block of an unchanged page is gone");
+                    return NULL;
+                }
+                mm->check_anchor[page] = 0;
+            }
+            if (!full && !DIRTY(p)) {
+                if (mm->check_anchor[p] != TO_OFF(ptr) ||
+                    !GET_PREV_ALLOC(HDRP(ptr)) != !prev_alloc) {
+                    check_error(ptr, "block of an unchanged page moved or changed");
+                    return NULL;
+                }
+                return ptr;
+            }
+            mm->check_anchor[p] = TO_OFF(ptr);
+#endif
+            page = p;
+        }
 
-    while (GET_SIZE(ptr) > 0) {
-        if (GET_SIZE(HDRP(ptr)) != GET_SIZE(FTRP(ptr))) {
-            printf("There are overlaped blocks.\n");
-            assert(0);
+        /* An epilogue ends the heap, or is followed by the next segment */
+        if (GET_SIZE(HDRP(ptr)) == 0) {
+            if (!GET_ALLOC(HDRP(ptr)) || !GET_PREV_ALLOC(HDRP(ptr)) != !prev_alloc) {
+                check_error(ptr, "epilogue is wrong");
+                return NULL;
+            }
+            if (HDRP(ptr) + WSIZE == end)
+                return end;
+            if ((ptr = check_segment(HDRP(ptr) + WSIZE)) == NULL)
+                return NULL;
+            prev_alloc = 1;
+            continue;
         }
+
+        if (check_block(ptr, prev_alloc, full) < 0)
+            return NULL;
+        prev_alloc = GET_ALLOC(HDRP(ptr)) != 0;
         ptr = NEXT_BLKP(ptr);
     }
 }
 
-/* Do the pointers in a heap block point to valid heap addresses? */
-static void check_heap_address() {
-    void *heap_lo = mem_heap_lo();
-    void *heap_hi = mem_heap_hi();
-    void *ptr = heap_start;
+/* Check every list and every block of the heap */
+static int check_full() {
+    size_t nodes = 0;
+    size_t i, words = (mem_heapsize() / DSIZE + 31) / 32;
+    char *ptr;
+    int a;
+
+    mm->check_found = 0;
+    for (a = 0; a < MM_ARENAS; a++) {
+        arena = &mm->arenas[a];
+        if (check_lists(&nodes) < 0)
+            goto broken;
+    }
+    if ((ptr = check_segment(mm->heap_base)) == NULL || check_walk(ptr, 1, -1) == NULL)
+        goto broken;
+
+    /* Marks left are of list nodes the walk did not meet */
+    if (mm->check_found != nodes) {
+        for (i = 0; i < words && mm->check_nodes[i] == 0; i++)
+            ;
+        if (i < words)
+            check_error(mm->heap_base +
+                        (i * 32 + __builtin_ctz(mm->check_nodes[i])) * DSIZE,
+                        "free list node is no free block of the heap");
+        else
+            check_error(NULL, "free list node is out of the heap");
+        goto broken;
+    }
+
+#if MM_CHECK
+    memset(mm->check_dirty, 0, mm->heap_max / PAGE_SIZE / 8);
+    mm->check_stale = 0;
+#endif
+    return 0;
+
+broken:
+    memset(mm->check_nodes, 0, words * sizeof(unsigned int));
+    return -1;
+}
+
+#if MM_CHECK
+/* Mark the pages of bytes lo .. hi of the heap as changed */
+static void check_touch(char *lo, char *hi) {
+    long i;
+
+    for (i = PAGE_INDEX(lo); i <= PAGE_INDEX(hi); i++)
+        __atomic_fetch_or(&mm->check_dirty[i / 32], 1u << (i % 32), __ATOMIC_RELAXED);
+}
 
-    while (GET_SIZE(ptr) > 0) {
-        if (!(heap_lo <= ptr && ptr <= heap_hi)) {
-            printf("There is a block which do not have valid heap address.\n");
-            assert(0);
+/* Check the blocks of the pages changed since the last check */
+static int check_pages() {
+    long npages = PAGE_INDEX(mem_heap_hi()) + 1;
+    long i, s, dirty = 0;
+    char *end = (char *)mem_heap_hi() + 1;
+    char *ptr, *node;
+    int a;
+
+    for (i = 0; i < npages; i += 32)
+        dirty += __builtin_popcount(mm->check_dirty[i / 32]);
+    if (mm->check_stale || dirty * CHECK_SHARE > npages)
+        return check_full();
+
+    /* Lists are checked where they start, and through changed blocks */
+    for (a = 0; a < MM_ARENAS; a++) {
+        arena = &mm->arenas[a];
+        for (i = 0; i < LIST_COUNT; i++) {
+            int set = i / SL_COUNT;
+            node = GET_LIST(i);
+            if (!(arena->list_map & 1u << set) != !arena->sl_map[set] ||
+                !(arena->sl_map[set] & 1u << (i % SL_COUNT)) != !node)
+                return check_error(node, "list bitmap is wrong");
+            if (node != NULL &&
+                (!IN_HEAP(node) || GET_ALLOC(HDRP(node)) ||
+                 NEXT_NODE(node) != NULL || getIndex(GET_SIZE(HDRP(node))) != i))
+                return check_error(node, "head of a free list is wrong");
         }
-        ptr = NEXT_BLKP(ptr);
     }
+
+    for (i = 0; i < npages; i++) {
+        if (!DIRTY(i))
+            continue;
+        for (s = i; s > 0 && (DIRTY(s - 1) || mm->check_anchor[s - 1] == 0); s--)
+            ;
+        if (s > 0)
+            ptr = check_walk(TO_PTR(mm->check_anchor[s - 1]), 0, s - 1);
+        else if ((ptr = check_segment(mm->heap_base)) != NULL)
+            ptr = check_walk(ptr, 0, -1);
+        if (ptr == NULL)
+            return -1;
+
+        /* Pages walked through are checked, and their first block known */
+        for (; i < npages && (ptr == end || i < PAGE_INDEX(HDRP(ptr))); i++)
+            mm->check_dirty[i / 32] &= ~(1u << (i % 32));
+    }
+    memset(mm->check_dirty, 0, mm->heap_max / PAGE_SIZE / 8);
+    return 0;
 }
+#endif
 
-/* Heap Consistency Checker */
-static void mm_check() {
-    check_mark_free();
-    check_contiguous_free();
-    check_free_in_list();
-    check_valid_free();
-    check_block_overlap();
-    check_heap_address();
+/*
+ * mm_check - Check the heap for consistency. Returns 0 if it is, or -1
+ *     after printing what is wrong. An incremental check only looks at
+ *     blocks changed since the last check, which needs MM_CHECK, and is
+ *     full otherwise. The heap must not be in use by other threads.
+ */
+int mm_check(int incremental) {
+    arena_t *saved = arena;
+    int ret;
+
+#if MM_CHECK
+    ret = incremental ? check_pages() : check_full();
+#else
+    ret = check_full();
+#endif
+    arena = saved;
+    return ret;
 }
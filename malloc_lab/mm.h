@@ -1,9 +1,93 @@
 #include <stdio.h>
 
+/*
+ * Build-time options. Override them through MMFLAGS in the Makefile,
+ * e.g. "make clean; make MMFLAGS=-DMM_THREADS=1".
+ */
+#ifndef MM_THREADS
+#define MM_THREADS 0 /* Thread-safe heap with per-thread caches */
+#endif
+#define MM_SEGLIST 0 /* Segregated fit, small lists sorted by size */
+#define MM_TLSF 1    /* Two-level segregated fit in constant time */
+#ifndef MM_POLICY
+#define MM_POLICY MM_SEGLIST /* Free block index and fit policy */
+#endif
+#define MM_BY_SIZE 0 /* Small lists sorted by size, for best fit */
+#define MM_BY_ADDR 1 /* Sorted by address, for first fit among neighbours */
+#ifndef MM_ORDER
+#define MM_ORDER MM_BY_SIZE /* Order of the small free lists */
+#endif
+#ifndef MM_PREFETCH
+#define MM_PREFETCH 0 /* Prefetch the next node while walking a small list */
+#endif
+#ifndef MM_DEFER
+#define MM_DEFER 0 /* Coalesce freed blocks lazily, in batches */
+#endif
+#ifndef MM_REALLOC_CAP
+#define MM_REALLOC_CAP 4096 /* Most headroom kept for a block grown by realloc */
+#endif
+#ifndef MM_MMAP_THRESHOLD
+#define MM_MMAP_THRESHOLD (128 * 1024) /* Requests given a mapping of their own */
+#endif
+#ifndef MM_TRIM_THRESHOLD
+#define MM_TRIM_THRESHOLD (128 * 1024) /* Free heap end given back to memlib */
+#endif
+#ifndef MM_ARENAS
+#define MM_ARENAS (MM_THREADS ? 4 : 1) /* Independent heaps, one per thread */
+#endif
+#ifndef MM_PROFILE
+#define MM_PROFILE 0 /* Count requests by size class and list searches */
+#endif
+#ifndef MM_LIFETIME
+#define MM_LIFETIME 0 /* Place blocks predicted short-lived apart */
+#endif
+#ifndef MM_CHECK
+#define MM_CHECK 0 /* Track changed blocks, for incremental mm_check */
+#endif
+#ifndef MM_ACCESS
+#define MM_ACCESS 0 /* Log heap words read and written, for cache_lab/csim */
+#endif
+
+/* State of one instance of the allocator, see mm_use */
+typedef struct mm_heap mm_heap_t;
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
+extern void mm_free_batch(void **ptrs, int n);
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern int mm_check(int incremental);
+
+/* Statistics of one of the MM_ARENAS arenas */
+typedef struct {
+    size_t heap_size;    /* bytes of heap segments owned by the arena */
+    size_t free_bytes;   /* bytes in free blocks of its segregated list */
+    size_t remote_frees; /* blocks freed into it by other threads */
+    size_t realloc_copies;   /* reallocs that moved the payload */
+    size_t realloc_in_place; /* reallocs grown into a neighbour or brk */
+    size_t realloc_headroom; /* reallocs that fit in headroom of a block */
+    size_t grow;             /* least bytes the heap grows by next time */
+    size_t sbrk_calls;       /* number of mem_sbrk calls */
+} mm_arena_stats_t;
+
+extern void mm_arena_stats(int i, mm_arena_stats_t *stats);
+
+extern mm_heap_t *mm_heap_create(void);
+extern void mm_heap_destroy(mm_heap_t *heap);
+extern void mm_use(mm_heap_t *heap);
+extern mm_heap_t *mm_current(void);
+
+#if MM_PROFILE
+extern void mm_profile_dump(FILE *out);
+#endif
+#if MM_ACCESS
+extern void mm_access_log(FILE *out);
+#endif
 
 
 /* 
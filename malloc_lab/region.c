@@ -0,0 +1,128 @@
+/*
+ * region.c - Region allocator layered on the mm package.
+ *
+ * A region owns a list of chunks obtained from mm_malloc. Objects are
+ * carved from the newest chunk by bumping a pointer, and have no header
+ * of their own. A request too large for a chunk gets a chunk of its own,
+ * which is linked behind the newest one so that bumping goes on there.
+ * Resetting a region gives back every chunk but the first, which is
+ * reused, and destroying it gives back the first too.
+ */
+#include "region.h"
+
+#include "mm.h"
+
+/* Objects are aligned like the blocks of mm_malloc */
+#define ALIGNMENT 8
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+
+#define REGION_CHUNK (1 << 14) /* Bytes of a chunk, header included */
+#define REGION_LARGE (REGION_CHUNK / 4) /* Larger objects get own chunk */
+
+/* Header of a chunk, followed by the objects carved from it */
+typedef struct chunk {
+    struct chunk *next; /* Chunk allocated before this one */
+    size_t size;        /* Bytes of the chunk, header included */
+} chunk_t;
+
+#define CHUNK_HDR ALIGN(sizeof(chunk_t))
+
+struct region {
+    chunk_t *chunks; /* Newest chunk, whose free space is [cur, end) */
+    chunk_t *first;  /* Chunk made with the region, which reset keeps */
+    char *cur;
+    char *end;
+};
+
+/* Add a chunk of size bytes to the region, NULL if mm_malloc fails */
+static chunk_t *new_chunk(region_t *region, size_t size) {
+    chunk_t *chunk;
+
+    if ((chunk = mm_malloc(size)) == NULL)
+        return NULL;
+    chunk->size = size;
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+    region->cur = (char *)chunk + CHUNK_HDR;
+    region->end = (char *)chunk + size;
+    return chunk;
+}
+
+/*
+ * mm_region_create - Create an empty region with one chunk.
+ */
+region_t *mm_region_create(void) {
+    region_t *region;
+
+    if ((region = mm_malloc(sizeof(region_t))) == NULL)
+        return NULL;
+    region->chunks = NULL;
+    if (new_chunk(region, REGION_CHUNK) == NULL) {
+        mm_free(region);
+        return NULL;
+    }
+    region->first = region->chunks;
+    return region;
+}
+
+/*
+ * mm_region_alloc - Allocate size bytes in the region. The object lives
+ *     until the region is reset or destroyed.
+ */
+void *mm_region_alloc(region_t *region, size_t size) {
+    chunk_t *chunk;
+    char *ptr;
+
+    size = ALIGN(size);
+    if (size <= (size_t)(region->end - region->cur)) {
+        ptr = region->cur;
+        region->cur += size;
+        return ptr;
+    }
+
+    /* A large object is put behind the newest chunk, which stays newest */
+    if (size > REGION_LARGE) {
+        if ((chunk = mm_malloc(CHUNK_HDR + size)) == NULL)
+            return NULL;
+        chunk->size = CHUNK_HDR + size;
+        chunk->next = region->chunks->next;
+        region->chunks->next = chunk;
+        return (char *)chunk + CHUNK_HDR;
+    }
+
+    if (new_chunk(region, REGION_CHUNK) == NULL)
+        return NULL;
+    ptr = region->cur;
+    region->cur += size;
+    return ptr;
+}
+
+/*
+ * mm_region_reset - Free every object of the region at once, keeping
+ *     its first chunk for the objects to come.
+ */
+void mm_region_reset(region_t *region) {
+    chunk_t *chunk;
+    chunk_t *next;
+
+    /* Large chunks may lie behind the first one too */
+    for (chunk = region->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        if (chunk != region->first)
+            mm_free(chunk);
+    }
+    chunk = region->first;
+    chunk->next = NULL;
+    region->chunks = chunk;
+    region->cur = (char *)chunk + CHUNK_HDR;
+    region->end = (char *)chunk + chunk->size;
+}
+
+/*
+ * mm_region_destroy - Free every object of the region and the region.
+ */
+void mm_region_destroy(region_t *region) {
+    mm_region_reset(region);
+    mm_free(region->chunks);
+    mm_free(region);
+}
@@ -0,0 +1,13 @@
+/*
+ * region.h - Region allocator layered on the mm package. Objects are
+ * bump-allocated inside large blocks from mm_malloc, and are all freed
+ * at once by resetting or destroying their region.
+ */
+#include <stddef.h>
+
+typedef struct region region_t;
+
+extern region_t *mm_region_create(void);
+extern void *mm_region_alloc(region_t *region, size_t size);
+extern void mm_region_reset(region_t *region);
+extern void mm_region_destroy(region_t *region);
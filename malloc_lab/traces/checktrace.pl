@@ -49,6 +49,12 @@ $summary = $opt_s;
 #
 %HASH = (); 
 
+#
+# REGION lists the outstanding ids tagged with each region. A region
+# reset frees them all.
+#
+%REGION = ();
+
 # Read the trace header values
 $heap_size = <STDIN>;
 chomp($heap_size);
@@ -73,6 +79,16 @@ while ($line = <STDIN>) {
 
     ($cmd, $id, $size) = split(" ", $line);
 
+    # calloc and aligned_alloc allocate like malloc, and so does an
+    # allocation tagged with a region
+    if ($cmd eq "c" or $cmd eq "m") {
+	$cmd = "a";
+    }
+    if ($cmd eq "g") {
+	($cmd, $id, $region, $size) = split(" ", $line);
+	push @{$REGION{$region}}, $id;
+    }
+
     # ignore blank lines
     if (!$cmd) {
 	next;
@@ -81,14 +97,42 @@ while ($line = <STDIN>) {
     # save the line for output later
     $lines[$requestnum++] = $line;
 
+    # a region reset frees the ids tagged with the region
+    if ($cmd eq "x") {
+	foreach $key (@{$REGION{$id}}) {
+	    delete $HASH{$key};
+	}
+	delete $REGION{$id};
+	next;
+    }
+
     #ignore realloc requests, as long as they are preceeded by an alloc request
     if ($cmd eq "r") {
 	if (!$HASH{$id}) {
 	    die "$0: ERROR[$linenum]: realloc without previous alloc\n";
 	}
+	if ($HASH{$id} eq "g") {
+	    die "$0: ERROR[$linenum]: realloc of a block of a region\n";
+	}
+	next;
+    }
+
+    # and likewise usable size requests
+    if ($cmd eq "u") {
+	if (!$HASH{$id}) {
+	    die "$0: ERROR[$linenum]: usable size without previous alloc\n";
+	}
 	next;
     }
 
+    if ($cmd eq "g" and $HASH{$id}) {
+	die "$0: ERROR[$linenum]: allocate with no intervening free.\n";
+    }
+
+    if ($cmd eq "f" and $HASH{$id} eq "g") {
+	die "$0: ERROR[$linenum]: freeing a block of a region.\n";
+    }
+
     if ($cmd eq "a" and $HASH{$id} eq "a") {
 	die "$0: ERROR[$linenum]: allocate with no intervening free.\n";
     }
@@ -131,7 +175,8 @@ if ($summary) {
 #
 # Output a balanced version of the trace
 #
-$new_ops = keys %HASH;
+$new_ops = grep { $HASH{$_} ne "g" } keys %HASH;
+$new_ops += keys %REGION;
 $new_num_ops = $old_num_ops + $new_ops;
 
 print "$heap_size\n";
@@ -144,12 +189,18 @@ foreach $item (@lines) {
     print "$item\n";
 }
 
-# print a set of free requests that will balance the trace
+# print a set of free requests and region resets that will balance the trace
 foreach $key (sort keys %HASH) {
+    if ($HASH{$key} eq "g") {
+	next;
+    }
     if ($HASH{$key} ne "a" and $HASH{$key} ne "r") {
 	die "$0: ERROR: Invalid free request in residue.\n";
     }
     print "f $key\n";
 }
+foreach $key (sort keys %REGION) {
+    print "x $key\n";
+}
 
 exit;
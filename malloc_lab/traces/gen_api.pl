@@ -0,0 +1,62 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "api.rep";
+$num_blocks = 2400;
+$max_blk_size = 4096;
+$max_live = 200;
+@aligns = (16, 32, 64, 64, 128, 4096);
+
+srand(15213);
+
+# Each block is allocated by malloc, calloc or aligned_alloc, and its
+# usable size read like a container would. Some are grown by realloc.
+$live = [];
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    $size = int(rand $max_blk_size) + 1;
+    $kind = int(rand 3);
+    if ($kind == 0) {
+	push @trace, "a $i $size";
+    } elsif ($kind == 1) {
+	push @trace, "c $i $size";
+    } else {
+	$align = $aligns[int(rand @aligns)];
+	push @trace, "m $i $align $size";
+    }
+    $total_block_size += $size;
+    push @trace, "u $i";
+    if (rand() < 0.25) {
+	$size = int($size * 3 / 2) + 1;
+	push @trace, "r $i $size";
+	push @trace, "u $i";
+    }
+    push @$live, $i;
+
+    # Free a random block once enough of them are live
+    if (@$live > $max_live) {
+	$j = int(rand @$live);
+	push @trace, "f $live->[$j]";
+	splice @$live, $j, 1;
+    }
+}
+foreach $id (@$live) {
+    push @trace, "f $id";
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = @trace;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+foreach $line (@trace) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
@@ -0,0 +1,52 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "api2.rep";
+$num_blocks = 400;
+$max_blk_size = 60000;
+$max_live = 200;
+
+srand(15213);
+
+# Blocks of up to 60000 bytes allocated by malloc or calloc and freed
+# at random, so that the heap often grows under a calloc and the new
+# chunk merges with a free block that ends the heap.
+$live = [];
+for ($i = 0;  $i < $num_blocks; $i += 1) {
+    $size = int(rand $max_blk_size) + 1;
+    if (rand() < 0.5) {
+	push @trace, "a $i $size";
+    } else {
+	push @trace, "c $i $size";
+    }
+    $total_block_size += $size;
+    push @$live, $i;
+
+    # Free random blocks once enough of them are live
+    while (@$live > $max_live || (@$live > 1 && rand() < 0.5)) {
+	$j = int(rand @$live);
+	push @trace, "f $live->[$j]";
+	splice @$live, $j, 1;
+    }
+}
+foreach $id (@$live) {
+    push @trace, "f $id";
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_ops = @trace;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+foreach $line (@trace) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
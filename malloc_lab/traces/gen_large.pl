@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "large.rep";
+$max_live = 8000;
+$num_churn = 40000;
+$max_small_size = 1024;
+$max_large_size = 100 * 1024; # Below MM_MMAP_THRESHOLD, so in the heap
+
+srand(15213);
+
+# Half the blocks are small and half are tens of KB, so that a few
+# thousand live blocks spread over some 200 MB of heap. The heap is
+# filled, then blocks are freed and allocated at random, then all are
+# freed. Run it with "mdriver -M 512" for a heap that large.
+sub new_size {
+    return int(rand $max_small_size) + 1 if rand() < 0.5;
+    return int(rand ($max_large_size - 16384)) + 16384;
+}
+
+$id = 0;
+$live = [];
+for ($i = 0; $i < $max_live + $num_churn; $i += 1) {
+    if (@$live >= $max_live) {
+	$j = int(rand @$live);
+	push @trace, "f $live->[$j]";
+	splice @$live, $j, 1;
+    }
+    $size = new_size();
+    push @trace, "a $id $size";
+    $total_block_size += $size;
+    push @$live, $id;
+    $id += 1;
+}
+foreach $i (@$live) {
+    push @trace, "f $i";
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_blocks = $id;
+$num_ops = @trace;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+foreach $line (@trace) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
@@ -0,0 +1,77 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "region.rep";
+$num_requests = 400;
+$num_slots = 8;
+$max_obj_size = 256;
+$max_live_cache = 100;
+
+srand(15213);
+
+# A server handles up to num_slots requests at once, each in a region of
+# its own. A request allocates many small objects tagged with its region,
+# now and then a large one, and they all die when it ends. Between
+# requests, blocks of a cache live on with malloc and free.
+$id = 0;
+$started = 0;
+@active = ();
+$cache = [];
+while ($started < $num_requests or @active) {
+    # Start a request in a free slot
+    if ($started < $num_requests and @active < $num_slots) {
+	for ($slot = 0; grep { $_->[0] == $slot } @active; $slot += 1) {
+	}
+	push @active, [$slot, int(rand 200) + 20];
+	$started += 1;
+    }
+
+    # Serve a random request one step
+    $r = $active[int(rand @active)];
+    if ($r->[1]-- > 0) {
+	$size = int(rand $max_obj_size) + 1;
+	$size = int(rand 8192) + 4096 if rand() < 0.01;
+	push @trace, "g $id $r->[0] $size";
+	$total_block_size += $size;
+	$id += 1;
+    } else {
+	push @trace, "x $r->[0]";
+	@active = grep { $_ != $r } @active;
+    }
+
+    # Update the cache
+    if (rand() < 0.05) {
+	$size = int(rand 1024) + 1;
+	push @trace, "a $id $size";
+	$total_block_size += $size;
+	push @$cache, $id;
+	$id += 1;
+	if (@$cache > $max_live_cache) {
+	    $j = int(rand @$cache);
+	    push @trace, "f $cache->[$j]";
+	    splice @$cache, $j, 1;
+	}
+    }
+}
+foreach $i (@$cache) {
+    push @trace, "f $i";
+}
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$suggested_heap_size = $total_block_size + 100;
+$num_blocks = $id;
+$num_ops = @trace;
+
+print OUTFILE "$suggested_heap_size\n";
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+
+foreach $line (@trace) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;